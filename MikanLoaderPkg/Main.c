@@ -13,18 +13,10 @@
 #include  <Protocol/BlockIo.h>
 #include  <Guid/FileInfo.h>
 #include "frame_buffer_config.hpp" 
+#include "memory_map.hpp"
 #include "elf.hpp"
 
 
-struct MemoryMap {
-    UINTN buffer_size;
-    VOID* buffer;
-    UINTN map_size;
-    UINTN map_key;
-    UINTN descriptor_size;
-    UINT32 descriptor_version;
-};
-
 EFI_STATUS GetMemoryMap(struct MemoryMap* map) {
     if (map->buffer == NULL) {
         return EFI_BUFFER_TOO_SMALL;
@@ -377,10 +369,12 @@ EFI_STATUS EFIAPI UefiMain(
             Print(L"Unimplemented pixel format: %d\n", gop->Mode->Info->PixelFormat);
             Halt();
     }
-    typedef void __attribute__((sysv_abi)) EntryPointType(const struct FrameBufferConfig*);
+    // カーネルはメモリマップからヒープに使う空き領域を探す
+    typedef void __attribute__((sysv_abi)) EntryPointType(
+        const struct FrameBufferConfig*, const struct MemoryMap*);
 
     EntryPointType* entry_point = (EntryPointType*)entry_addr;
-    entry_point(&config);
+    entry_point(&config, &memmap);
 
     Print(L"All done\n");
     while(1);
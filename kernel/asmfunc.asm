@@ -5,6 +5,19 @@
 
 bits 64 
 section .text
+global IoOut8   ;   void IoOut8(uint16_t addr, uint8_t data);
+IoOut8:
+    mov dx, di      ; dx = addr(di)
+    mov al, sil     ; al = data(sil)
+    out dx, al      ; output data(8bit) to output address(dx)
+    ret
+
+global IoIn8    ; uint8_t IoIn8(uint16_t addr);
+IoIn8:
+    mov dx, di  ; dx = addr
+    in al, dx
+    ret
+
 global IoOut32  ;   void IsOut32(uint16_t addr, uint32_t data);
 IoOut32:
     mov dx, di      ; dx = addr(di)
@@ -17,3 +30,141 @@ IoIn32:
     mov dx, di  ; dx = addr 
     in eax, dx 
     ret 
+
+global ReadTSC  ; uint64_t ReadTSC();
+ReadTSC:
+    rdtsc           ; edx:eax = タイムスタンプカウンタ
+    shl rdx, 32
+    or rax, rdx
+    ret
+
+global LoadIDT  ; void LoadIDT(uint16_t limit, uint64_t offset);
+LoadIDT:
+    push rbp
+    mov rbp, rsp
+    sub rsp, 10
+    mov [rsp], di       ; limit
+    mov [rsp + 2], rsi  ; offset
+    lidt [rsp]
+    mov rsp, rbp
+    pop rbp
+    ret
+
+global GetCS    ; uint16_t GetCS();
+GetCS:
+    xor eax, eax
+    mov ax, cs
+    ret
+
+global ReadCPUID    ; void ReadCPUID(uint32_t leaf, uint32_t subleaf,
+                    ;                uint32_t* regs);
+ReadCPUID:
+    push rbx        ; rbx は callee-saved
+    mov r8, rdx     ; r8 = regs (cpuid が rdx を壊すので退避)
+    mov eax, edi
+    mov ecx, esi
+    cpuid
+    mov [r8], eax
+    mov [r8 + 4], ebx
+    mov [r8 + 8], ecx
+    mov [r8 + 12], edx
+    pop rbx
+    ret
+
+global WriteMSR     ; void WriteMSR(uint32_t msr, uint64_t value);
+WriteMSR:
+    mov rdx, rsi
+    shr rdx, 32     ; edx:eax = value
+    mov eax, esi
+    mov ecx, edi
+    wrmsr
+    ret
+
+global GetSS    ; uint16_t GetSS();
+GetSS:
+    xor eax, eax
+    mov ax, ss
+    ret
+
+global GetCR3   ; uint64_t GetCR3();
+GetCR3:
+    mov rax, cr3
+    ret
+
+global SwitchContext    ; void SwitchContext(void* next_ctx, void* current_ctx);
+SwitchContext:
+    ; 今のタスクの状態を current_ctx (TaskContext, task.hpp) に保存する
+    mov [rsi + 0x40], rax
+    mov [rsi + 0x48], rbx
+    mov [rsi + 0x50], rcx
+    mov [rsi + 0x58], rdx
+    mov [rsi + 0x60], rdi
+    mov [rsi + 0x68], rsi
+
+    lea rax, [rsp + 8]
+    mov [rsi + 0x70], rax   ; RSP (この関数から戻った後の値)
+    mov [rsi + 0x78], rbp
+
+    mov [rsi + 0x80], r8
+    mov [rsi + 0x88], r9
+    mov [rsi + 0x90], r10
+    mov [rsi + 0x98], r11
+    mov [rsi + 0xa0], r12
+    mov [rsi + 0xa8], r13
+    mov [rsi + 0xb0], r14
+    mov [rsi + 0xb8], r15
+
+    mov rax, cr3
+    mov [rsi + 0x00], rax   ; CR3
+    mov rax, [rsp]
+    mov [rsi + 0x08], rax   ; RIP (戻り先)
+    pushfq
+    pop qword [rsi + 0x10]  ; RFLAGS
+
+    xor eax, eax
+    mov ax, cs
+    mov [rsi + 0x20], rax
+    mov ax, ss
+    mov [rsi + 0x28], rax
+    mov ax, fs
+    mov [rsi + 0x30], rax
+    mov ax, gs
+    mov [rsi + 0x38], rax
+
+    fxsave [rsi + 0xc0]     ; x87 FPU, MMX, SSE のレジスタ
+
+    ; iretq で RIP, CS, RFLAGS, RSP, SS をまとめて切り替えるためのフレーム
+    push qword [rdi + 0x28] ; SS
+    push qword [rdi + 0x70] ; RSP
+    push qword [rdi + 0x10] ; RFLAGS
+    push qword [rdi + 0x20] ; CS
+    push qword [rdi + 0x08] ; RIP
+
+    ; 次のタスクの状態を next_ctx から戻す
+    fxrstor [rdi + 0xc0]
+
+    mov rax, [rdi + 0x00]
+    mov cr3, rax
+    mov rax, [rdi + 0x30]
+    mov fs, ax
+    mov rax, [rdi + 0x38]
+    mov gs, ax
+
+    mov rax, [rdi + 0x40]
+    mov rbx, [rdi + 0x48]
+    mov rcx, [rdi + 0x50]
+    mov rdx, [rdi + 0x58]
+    mov rsi, [rdi + 0x68]
+    mov rbp, [rdi + 0x78]
+    mov r8,  [rdi + 0x80]
+    mov r9,  [rdi + 0x88]
+    mov r10, [rdi + 0x90]
+    mov r11, [rdi + 0x98]
+    mov r12, [rdi + 0xa0]
+    mov r13, [rdi + 0xa8]
+    mov r14, [rdi + 0xb0]
+    mov r15, [rdi + 0xb8]
+
+    mov rdi, [rdi + 0x60]   ; rdi は最後に戻す
+
+    o64 iret
@@ -3,6 +3,16 @@
 #include <stdint.h>
 
 extern "C" {
+void IoOut8(uint16_t addr, uint8_t data);
+uint8_t IoIn8(uint16_t addr);
 void IoOut32(uint16_t addr, uint32_t data);
 uint32_t IoIn32(uint16_t addr);
+uint64_t ReadTSC();
+void LoadIDT(uint16_t limit, uint64_t offset);
+uint16_t GetCS();
+void ReadCPUID(uint32_t leaf, uint32_t subleaf, uint32_t* regs);
+void WriteMSR(uint32_t msr, uint64_t value);
+uint16_t GetSS();
+uint64_t GetCR3();
+void SwitchContext(void* next_ctx, void* current_ctx);
 }
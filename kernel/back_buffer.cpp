@@ -0,0 +1,97 @@
+#include "back_buffer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    int Area(const Rectangle<int>& r) { return r.size.x * r.size.y; }
+
+    /** @brief a と b を両方含む最小の矩形を返す */
+    Rectangle<int> Union(const Rectangle<int>& a, const Rectangle<int>& b) {
+        const int left = std::min(a.pos.x, b.pos.x);
+        const int top = std::min(a.pos.y, b.pos.y);
+        const int right = std::max(a.pos.x + a.size.x, b.pos.x + b.size.x);
+        const int bottom = std::max(a.pos.y + a.size.y, b.pos.y + b.size.y);
+        return {{left, top}, {right - left, bottom - top}};
+    }
+
+    /** @brief a と b が重なっているか、辺で接している場合に真を返す */
+    bool Touches(const Rectangle<int>& a, const Rectangle<int>& b) {
+        return a.pos.x <= b.pos.x + b.size.x && b.pos.x <= a.pos.x + a.size.x &&
+               a.pos.y <= b.pos.y + b.size.y && b.pos.y <= a.pos.y + a.size.y;
+    }
+}  // namespace
+
+Error BackBuffer::Initialize(const FrameBufferConfig& screen_config) {
+    screen_config_ = screen_config;
+    config_ = screen_config;
+    num_dirty_rects_ = 0;
+
+    // 裏画面は余白なしで詰めて持つ (1 行 = horizontal_resolution ピクセル)
+    const size_t bytes = 4 * static_cast<size_t>(
+                                 screen_config.horizontal_resolution) *
+                         screen_config.vertical_resolution;
+    auto buffer = reinterpret_cast<uint8_t*>(malloc(bytes));
+    if (buffer == nullptr) {
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+    memset(buffer, 0, bytes);
+
+    config_.frame_buffer = buffer;
+    config_.pixels_per_scan_line = screen_config.horizontal_resolution;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void BackBuffer::MarkDirty(const Rectangle<int>& dirty) {
+    // 画面外の部分は記録しない
+    const Rectangle<int> screen{
+        {0, 0},
+        {static_cast<int>(screen_config_.horizontal_resolution),
+         static_cast<int>(screen_config_.vertical_resolution)}};
+    const auto area = dirty & screen;
+    if (IsEmpty(area)) {
+        return;
+    }
+
+    // 既存の領域と重なるか接していれば、まとめて 1 つの領域にする
+    for (int i = 0; i < num_dirty_rects_; ++i) {
+        if (Touches(dirty_rects_[i], area)) {
+            dirty_rects_[i] = Union(dirty_rects_[i], area);
+            return;
+        }
+    }
+
+    if (num_dirty_rects_ < kMaxDirtyRects) {
+        dirty_rects_[num_dirty_rects_++] = area;
+        return;
+    }
+
+    // 空きがなければ、結合による面積の増分が最も小さい領域と結合する
+    int best = 0;
+    int best_growth =
+        Area(Union(dirty_rects_[0], area)) - Area(dirty_rects_[0]);
+    for (int i = 1; i < num_dirty_rects_; ++i) {
+        const int growth =
+            Area(Union(dirty_rects_[i], area)) - Area(dirty_rects_[i]);
+        if (growth < best_growth) {
+            best = i;
+            best_growth = growth;
+        }
+    }
+    dirty_rects_[best] = Union(dirty_rects_[best], area);
+}
+
+void BackBuffer::Flush() {
+    if (config_.frame_buffer == screen_config_.frame_buffer) {
+        // 裏画面を確保できず直接描画している
+        num_dirty_rects_ = 0;
+        return;
+    }
+
+    // 画面外にはみ出した部分は CopyRect が切り詰める
+    for (int i = 0; i < num_dirty_rects_; ++i) {
+        CopyRect(screen_config_, dirty_rects_[i].pos, config_, dirty_rects_[i]);
+    }
+    num_dirty_rects_ = 0;
+}
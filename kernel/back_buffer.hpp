@@ -0,0 +1,54 @@
+/**
+ * @file back_buffer.hpp
+ *
+ * 描画先となるメインメモリ上の裏画面と、画面への転送機能。
+ */
+
+#pragma once
+
+#include <array>
+
+#include "error.hpp"
+#include "frame_buffer_config.hpp"
+#include "graphics.hpp"
+
+/** @brief フレームバッファの内容をメインメモリ上に持つ裏画面.
+ *
+ * 描画はすべて Config() が指すメインメモリ上の領域に対して行い、
+ * 変更した領域を MarkDirty で記録しておく。
+ * Flush を呼ぶと、記録された領域だけを本物のフレームバッファへ行単位で転送する。
+ * フレームバッファ (VRAM) からの読み出しは非常に遅いが、
+ * 裏画面からなら普通のメモリと同じ速さで読み出せる。
+ */
+class BackBuffer {
+   public:
+    /** @brief 記録できる変更領域の最大数. 超えた分は既存の領域と結合する */
+    static const int kMaxDirtyRects = 16;
+
+    /** @brief screen_config と同じ大きさ・ピクセルフォーマットの裏画面を確保する.
+     *
+     * @return メモリを確保できなかった場合は Error::kNoEnoughMemory.
+     *   このとき Config() は screen_config をそのまま指し、直接描画になる。
+     */
+    Error Initialize(const FrameBufferConfig& screen_config);
+
+    /** @brief 描画先として使う裏画面の設定 */
+    const FrameBufferConfig& Config() const { return config_; }
+
+    /** @brief dirty の範囲が変更されたことを記録する. 画面外の部分は無視する */
+    void MarkDirty(const Rectangle<int>& dirty);
+
+    /** @brief 変更が記録された領域を画面へ転送し、記録を消去する */
+    void Flush();
+
+    /** @brief 記録されている変更領域の数 */
+    int NumDirtyRects() const { return num_dirty_rects_; }
+    /** @brief i 番目の変更領域 (画面外にはみ出していることもある) */
+    const Rectangle<int>& DirtyRect(int i) const { return dirty_rects_[i]; }
+
+   private:
+    FrameBufferConfig screen_config_{};
+    FrameBufferConfig config_{};
+    std::array<Rectangle<int>, kMaxDirtyRects> dirty_rects_{};
+    int num_dirty_rects_{0};
+};
@@ -0,0 +1,86 @@
+#include "clock.hpp"
+
+namespace {
+    // PIT (8254) のチャネル 2 と、そのゲートを制御するポート
+    const uint16_t kPITChannel2 = 0x42;
+    const uint16_t kPITCommand = 0x43;
+    const uint16_t kPITGate = 0x61;
+    const uint8_t kPITGateEnable = 0x01;
+    const uint8_t kPITSpeakerEnable = 0x02;
+    const uint8_t kPITOutput2 = 0x20;
+    // チャネル 2, 下位→上位バイトの順に書く, モード 0 (カウント終了で出力が立つ)
+    const uint8_t kPITChannel2Mode0 = 0xb0;
+
+    const uint32_t kPITFrequency = 1193182;
+    /** @brief 1 回の計測の長さ. PIT の 16 ビットのカウンタに収まること */
+    const uint32_t kCalibrationMs = 20;
+    const int kCalibrationRounds = 3;
+    /** @brief PIT が動いていない場合に待つのを諦めるまでのポーリング回数 */
+    const int kMaxPolls = 10'000'000;
+
+    uint64_t tsc_frequency = 0;
+    // ナノ秒への換算係数. ns = cycles * ns_per_cycle >> 32
+    uint64_t ns_per_cycle = 0;
+
+    /** @brief PIT で kCalibrationMs ミリ秒を計る間に TSC が進んだ量 */
+    uint64_t MeasureTSC() {
+        const uint32_t count = kPITFrequency * kCalibrationMs / 1000;
+        static_assert(kPITFrequency * kCalibrationMs / 1000 <= 0xffff);
+
+        // ゲートを下げてからカウンタを設定し、ゲートを上げた時点で数え始める.
+        // スピーカーには出力しない
+        const uint8_t gate = IoIn8(kPITGate) & ~(kPITGateEnable |
+                                                 kPITSpeakerEnable);
+        IoOut8(kPITGate, gate);
+        IoOut8(kPITCommand, kPITChannel2Mode0);
+        IoOut8(kPITChannel2, count & 0xffu);
+        IoOut8(kPITChannel2, count >> 8);
+
+        IoOut8(kPITGate, gate | kPITGateEnable);
+        const uint64_t start = ReadTSC();
+        int polls = 0;
+        while ((IoIn8(kPITGate) & kPITOutput2) == 0) {
+            if (++polls == kMaxPolls) {
+                IoOut8(kPITGate, gate);
+                return 0;
+            }
+        }
+        const uint64_t end = ReadTSC();
+
+        IoOut8(kPITGate, gate);
+        return end - start;
+    }
+}  // namespace
+
+Error InitializeClock() {
+    // SMI などで計測が伸びることはあっても縮むことはないので、最小値を使う
+    uint64_t cycles = UINT64_MAX;
+    for (int i = 0; i < kCalibrationRounds; ++i) {
+        const uint64_t c = MeasureTSC();
+        cycles = c < cycles ? c : cycles;
+    }
+
+    const uint64_t hz = cycles * 1000 / kCalibrationMs;
+    // 100 MHz 未満の TSC はまず無いので、PIT が無いか動いていないとみなす
+    if (hz < 100'000'000) {
+        return MAKE_ERROR(Error::kUnknownDevice);
+    }
+
+    tsc_frequency = hz;
+    ns_per_cycle = (1'000'000'000ull << 32) / hz;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+uint64_t TSCFrequency() { return tsc_frequency; }
+
+uint64_t CyclesToNanoseconds(uint64_t cycles) {
+    // 除算を避けて乗算とシフトで換算する. 積は 64 ビットを超えうる
+    return (static_cast<unsigned __int128>(cycles) * ns_per_cycle) >> 32;
+}
+
+uint64_t NanosecondsToCycles(uint64_t ns) {
+    // 秒の部分と 1 秒未満の部分に分け、64 ビットに収めて計算する
+    const uint64_t kNsPerSec = 1'000'000'000;
+    return ns / kNsPerSec * tsc_frequency +
+           ns % kNsPerSec * tsc_frequency / kNsPerSec;
+}
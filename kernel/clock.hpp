@@ -0,0 +1,71 @@
+/**
+ * @file clock.hpp
+ *
+ * タイムスタンプカウンタ (TSC) を使った時刻の計測を提供する。
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "asmfunc.h"
+#include "error.hpp"
+
+/** @brief TSC の周波数を PIT と比べて求める.
+ *
+ * PIT のチャネル 2 を数十ミリ秒動かし、その間に TSC が進んだ量から求める。
+ * 起動時に一度だけ、割り込みを使い始める前に呼ぶ。
+ *
+ * @return 求めた周波数が明らかにおかしい場合は Error::kUnknownDevice
+ */
+Error InitializeClock();
+
+/** @brief TSC の周波数 (Hz). InitializeClock の前は 0 */
+uint64_t TSCFrequency();
+
+/** @brief cycles クロックをナノ秒に換算する */
+uint64_t CyclesToNanoseconds(uint64_t cycles);
+
+/** @brief ナノ秒 ns を TSC のクロック数に換算する */
+uint64_t NanosecondsToCycles(uint64_t ns);
+
+/** @brief CPU のリセットからの経過時間 (ナノ秒) */
+inline uint64_t NowNanoseconds() { return CyclesToNanoseconds(ReadTSC()); }
+
+/** @brief 処理にかかったクロック数の集計 */
+struct CycleStats {
+    uint64_t total = 0;
+    uint64_t max = 0;
+    uint64_t count = 0;
+
+    void Record(uint64_t cycles) {
+        total += cycles;
+        max = cycles > max ? cycles : max;
+        ++count;
+    }
+    uint64_t AverageNanoseconds() const {
+        return count ? CyclesToNanoseconds(total / count) : 0;
+    }
+};
+
+/** @brief 生成から破棄までにかかったクロック数を stats に記録する.
+ *
+ * @code
+ * static CycleStats render_stats;
+ * {
+ *     ScopedCycleTimer timer{render_stats};
+ *     console->Render();
+ * }
+ * @endcode
+ */
+class ScopedCycleTimer {
+   public:
+    ScopedCycleTimer(CycleStats& stats) : stats_{stats}, start_{ReadTSC()} {}
+    ~ScopedCycleTimer() { stats_.Record(ReadTSC() - start_); }
+    ScopedCycleTimer(const ScopedCycleTimer&) = delete;
+    ScopedCycleTimer& operator=(const ScopedCycleTimer&) = delete;
+
+   private:
+    CycleStats& stats_;
+    uint64_t start_;
+};
@@ -1,49 +1,396 @@
 #include "console.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
-#include "font.hpp"
-
-Console::Console(PixelWriter& writer, 
-    const PixelColor& fg_color, const PixelColor& bg_color) 
-    : writer_{writer}, fg_color_{fg_color}, bg_color_{bg_color},
-    buffer_{}, cursor_row_{0}, cursor_column_{0} {
-}
-// buffer_は、ヌル文字で初期化しておく
-
-void Console::PutString(const char* s) {
-    // 与えられた文字列を先頭から1文字ずつ描画する。
-    while (*s) {
-        if (*s == '\n') {
-            Newline();
-        } else if (cursor_column_ < kColumns - 1) {
-            WriteAscii(writer_, 8*cursor_column_, 16*cursor_row_, *s,  fg_color_);
-            buffer_[cursor_row_][cursor_column_] = *s;
-            ++cursor_column_;
+
+namespace {
+    // ANSI の 16 色 (0-7 が通常、8-15 が明るい色)
+    const PixelColor kAnsiColors[16] = {
+        {0, 0, 0},       {205, 0, 0},     {0, 205, 0},     {205, 205, 0},
+        {0, 0, 238},     {205, 0, 205},   {0, 205, 205},   {229, 229, 229},
+        {127, 127, 127}, {255, 0, 0},     {0, 255, 0},     {255, 255, 0},
+        {92, 92, 255},   {255, 0, 255},   {0, 255, 255},   {255, 255, 255},
+    };
+
+    void FillCells(Console::Cell* cells, int n, const Console::Cell& value) {
+        std::fill(cells, cells + n, value);
+    }
+}  // namespace
+
+Error Console::Initialize(int scrollback_lines) {
+    if (auto err = glyphs_.Initialize(font_scale_)) {
+        return err;
+    }
+
+    const int capacity = rows_ + std::max(scrollback_lines, 0);
+    const size_t num_cells = static_cast<size_t>(columns_) * capacity;
+    const size_t num_shown = static_cast<size_t>(columns_) * rows_;
+    auto lines = reinterpret_cast<Cell*>(malloc(sizeof(Cell) * num_cells));
+    auto shown = reinterpret_cast<Cell*>(malloc(sizeof(Cell) * num_shown));
+    if (lines == nullptr || shown == nullptr) {
+        free(lines);
+        free(shown);
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+    FillCells(lines, num_cells, BlankCell());
+    // 描画先は既定の背景色で塗られているものとする
+    FillCells(shown, num_shown, BlankCell());
+
+    free(lines_);
+    free(shown_);
+    lines_ = lines;
+    shown_ = shown;
+    capacity_ = capacity;
+    last_line_ = 0;
+    num_lines_ = 1;
+    scroll_ = 0;
+    bottom_row_ = 0;
+    pending_shift_ = 0;
+    dirty_ = false;
+    cursor_row_ = cursor_column_ = 0;
+
+    for (int i = 0; i < 16; ++i) {
+        palette_[i] = writer_.Pack(kAnsiColors[i]);
+    }
+    palette_[kDefaultFG] = writer_.Pack(fg_color_);
+    palette_[kDefaultBG] = writer_.Pack(bg_color_);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void Console::PutString(const char* s) { PutString(s, SIZE_MAX); }
+
+void Console::PutString(const char* s, size_t len) {
+    if (lines_ == nullptr) {
+        return;
+    }
+
+    // 文字の表を更新するだけで、描画は Render でまとめて行う
+    char32_t c;
+    while (int length = DecodeUtf8(s, len, c)) {
+        PutChar(c);
+        s += length;
+        len -= length;
+    }
+    dirty_ = true;
+}
+
+void Console::PutChar(char32_t c) {
+    switch (escape_state_) {
+        case EscapeState::kNone:
+            break;
+        case EscapeState::kEscape:
+            if (c == '[') {
+                escape_state_ = EscapeState::kCsi;
+                params_.fill(0);
+                num_params_ = 0;
+            } else {
+                // 対応していないエスケープシーケンスは読み捨てる
+                escape_state_ = EscapeState::kNone;
+            }
+            return;
+        case EscapeState::kCsi:
+            if ('0' <= c && c <= '9') {
+                num_params_ = std::max(num_params_, 1);
+                int& param = params_[num_params_ - 1];
+                param = std::min(10 * param + static_cast<int>(c - '0'), 9999);
+            } else if (c == ';') {
+                num_params_ = std::min(std::max(num_params_, 1) + 1,
+                                       kMaxParams);
+            } else {
+                ExecuteCsi(c);
+                escape_state_ = EscapeState::kNone;
+            }
+            return;
+    }
+
+    if (c == '\x1b') {
+        escape_state_ = EscapeState::kEscape;
+    } else if (c == '\n') {
+        Newline();
+    } else if (c == '\r') {
+        cursor_column_ = 0;
+    } else if (c >= 0x20) {
+        const int width = IsFullWidth(c) ? 2 : 1;
+        if (cursor_column_ + width > columns_ - 1) {
+            return;
+        }
+        const uint8_t fg = (bold_ && fg_ < 8) ? fg_ + 8 : fg_;
+        Cell* line = CursorLine();
+        BreakWideChar(line, cursor_column_);
+        line[cursor_column_] = {c, fg, bg_};
+        if (width == 2) {
+            BreakWideChar(line, cursor_column_ + 1);
+            line[cursor_column_ + 1] = {kWideTail, fg, bg_};
         }
-        ++s;
+        cursor_column_ += width;
     }
 }
 
+void Console::ExecuteCsi(char32_t c) {
+    switch (c) {
+        case 'm':
+            SelectGraphicRendition();
+            break;
+        case 'H':
+        case 'f':
+            MoveCursor(Param(0, 1) - 1, Param(1, 1) - 1);
+            break;
+        case 'K':
+            switch (Param(0, 0)) {
+                case 0:
+                    EraseCells(cursor_column_, columns_);
+                    break;
+                case 1:
+                    EraseCells(0, cursor_column_ + 1);
+                    break;
+                case 2:
+                    EraseCells(0, columns_);
+                    break;
+            }
+            break;
+    }
+}
+
+void Console::SelectGraphicRendition() {
+    // 引数が無ければ 0 (リセット) として扱う
+    for (int i = 0; i < std::max(num_params_, 1); ++i) {
+        const int p = params_[i];
+        if (p == 0) {
+            fg_ = kDefaultFG;
+            bg_ = kDefaultBG;
+            bold_ = false;
+        } else if (p == 1) {
+            bold_ = true;
+        } else if (p == 22) {
+            bold_ = false;
+        } else if (30 <= p && p <= 37) {
+            fg_ = p - 30;
+        } else if (p == 39) {
+            fg_ = kDefaultFG;
+        } else if (40 <= p && p <= 47) {
+            bg_ = p - 40;
+        } else if (p == 49) {
+            bg_ = kDefaultBG;
+        } else if (90 <= p && p <= 97) {
+            fg_ = p - 90 + 8;
+        } else if (100 <= p && p <= 107) {
+            bg_ = p - 100 + 8;
+        }
+    }
+}
+
+int Console::Param(int i, int default_value) const {
+    if (i >= num_params_ || params_[i] == 0) {
+        return default_value;
+    }
+    return params_[i];
+}
+
+void Console::Render() {
+    if (!dirty_ || lines_ == nullptr) {
+        return;
+    }
+    dirty_ = false;
+    ShiftShown(pending_shift_);
+    pending_shift_ = 0;
+
+    // 描画済みのセルと文字か色が異なるセルだけを描き直す
+    for (int row = 0; row < rows_; ++row) {
+        const Cell* line = Line(bottom_row_ - row + scroll_);
+        Cell* shown_row = shown_ + columns_ * row;
+        int left = columns_, right = -1;
+        for (int column = 0; column < columns_; ++column) {
+            Cell cell = line ? line[column] : BlankCell();
+            if (cursor_shown_ && scroll_ == 0 && row == cursor_row_ &&
+                column == cursor_column_ && cell.c != kWideTail) {
+                // 描画済みの表にも入れ替えた色で記録されるので、
+                // カーソルが消えたり移動したりすれば元の色で描き直される
+                std::swap(cell.fg, cell.bg);
+            }
+            // 全角文字は右側のセルと合わせて 1 度に描く
+            const int width =
+                (IsFullWidth(cell.c) && column + 1 < columns_) ? 2 : 1;
+            if (shown_row[column] == cell &&
+                (width == 1 || shown_row[column + 1] == line[column + 1])) {
+                column += width - 1;
+                continue;
+            }
+            WriteCell(row, column, cell);
+            shown_row[column] = cell;
+            if (width == 2) {
+                shown_row[column + 1] = line[column + 1];
+            }
+            left = std::min(left, column);
+            right = column + width - 1;
+            column += width - 1;
+        }
+        if (layer_manager_ && left <= right) {
+            const int w = glyphs_.CellWidth();
+            const int h = glyphs_.CellHeight();
+            layer_manager_->MarkDirty(
+                layer_id_, {{w * left, h * row}, {w * (right - left + 1), h}});
+        }
+    }
+
+    if (layer_manager_) {
+        layer_manager_->Draw();
+    }
+}
+
+void Console::ToggleCursor() {
+    cursor_shown_ = !cursor_shown_;
+    dirty_ = true;
+}
+
+void Console::WriteCell(int row, int column, const Cell& cell) {
+    // 空白と、対応する左側のセルが無い全角文字の右側は空白として描く
+    const char32_t c = (cell.c == '\0' || cell.c == kWideTail) ? ' ' : cell.c;
+    const uint32_t* glyph =
+        glyphs_.Get(c, palette_[cell.fg], palette_[cell.bg]);
+    write_glyph_(writer_, glyphs_.CellWidth() * column,
+                 glyphs_.CellHeight() * row, glyph, glyphs_.GlyphWidth(c),
+                 glyphs_.CellHeight());
+}
+
+void Console::SetLayer(LayerManager* layer_manager, unsigned int layer_id) {
+    layer_manager_ = layer_manager;
+    layer_id_ = layer_id;
+}
+
+void Console::Scroll(int lines) {
+    const int scroll = std::clamp(scroll_ + lines, 0, MaxScroll());
+    if (lines_ == nullptr || scroll == scroll_) {
+        return;
+    }
+    // さかのぼると表示は下へずれる
+    pending_shift_ -= scroll - scroll_;
+    scroll_ = scroll;
+    dirty_ = true;
+}
+
+void Console::ShiftShown(int shift) {
+    const int width = glyphs_.CellWidth() * columns_;
+    const int row_height = glyphs_.CellHeight();
+    const int num_rows = std::abs(shift);
+    if (num_rows == 0) {
+        return;
+    }
+    if (num_rows >= rows_) {
+        // 移動して残る部分が無いので、全体を背景色で塗るだけにする
+        writer_.FillRect({0, 0}, {width, row_height * rows_}, bg_color_);
+        FillCells(shown_, columns_ * rows_, BlankCell());
+        MarkDirtyRows(0, rows_);
+        return;
+    }
+
+    const int kept_rows = rows_ - num_rows;
+    const int kept_cells = columns_ * kept_rows;
+    const int cleared_cells = columns_ * num_rows;
+    if (shift > 0) {
+        // 下の kept_rows 行を上へ移動し、空いた下端を背景色で塗る
+        MoveRect(writer_.Config(), {0, 0},
+                 {{0, row_height * num_rows}, {width, row_height * kept_rows}});
+        writer_.FillRect({0, row_height * kept_rows},
+                         {width, row_height * num_rows}, bg_color_);
+        std::copy(shown_ + cleared_cells, shown_ + cleared_cells + kept_cells,
+                  shown_);
+        FillCells(shown_ + kept_cells, cleared_cells, BlankCell());
+    } else {
+        MoveRect(writer_.Config(), {0, row_height * num_rows},
+                 {{0, 0}, {width, row_height * kept_rows}});
+        writer_.FillRect({0, 0}, {width, row_height * num_rows}, bg_color_);
+        std::copy_backward(shown_, shown_ + kept_cells,
+                           shown_ + cleared_cells + kept_cells);
+        FillCells(shown_, cleared_cells, BlankCell());
+    }
+    MarkDirtyRows(0, rows_);
+}
+
+Console::Cell* Console::Line(int back) {
+    if (back < 0 || back >= num_lines_) {
+        return nullptr;
+    }
+    const int index = (last_line_ - back + capacity_) % capacity_;
+    return lines_ + static_cast<size_t>(columns_) * index;
+}
+
+int Console::MaxScroll() const {
+    // 画面の先頭行に最も古い行が来るまでさかのぼれる
+    return std::max(0, num_lines_ - 1 - bottom_row_);
+}
+
+void Console::MarkDirtyRows(int first_row, int num_rows) {
+    if (layer_manager_) {
+        const int row_height = glyphs_.CellHeight();
+        layer_manager_->MarkDirty(
+            layer_id_, {{0, row_height * first_row},
+                        {glyphs_.CellWidth() * columns_,
+                         row_height * num_rows}});
+    }
+}
 
 void Console::Newline() {
     // 改行文字に対する処理
-    // buffer_の次の行に移動する。
+    // 最新の行にいれば新しい行を追加し、そうでなければ次の行へ移動するだけ。
     cursor_column_ = 0;
-    if (cursor_row_ < kRows - 1) {
+    if (cursor_row_ < bottom_row_) {
         ++cursor_row_;
-    } else {
-        // 一旦、バックグラウンドカラーで塗りつぶす
-        for (int y = 0; y < 16 * kRows; y++) {
-            for (int x = 0; x < 8 * kColumns; x++) {
-                writer_.Write(x, y, bg_color_);
-            }
-        }
-        for(int row = 0; row < kRows -1; row++) {
-            // memcpy(dest, src, size)
-            // 2行目の内容を1行目に持ってくる
-            memcpy(buffer_[row], buffer_[row+1], kColumns+1);
-            WriteString(writer_, 0, 16 * row, buffer_[row], fg_color_);
-        }
-        memset(buffer_[kRows-1], 0, kColumns + 1);
+        return;
+    }
+    AppendLine();
+    cursor_row_ = bottom_row_;
+}
+
+void Console::AppendLine() {
+    // リングバッファの次の行を使う。最も古い行は上書きされる。
+    last_line_ = (last_line_ + 1) % capacity_;
+    num_lines_ = std::min(num_lines_ + 1, capacity_);
+    FillCells(Line(0), columns_, BlankCell());
+
+    if (bottom_row_ < rows_ - 1) {
+        ++bottom_row_;
+        return;
+    }
+
+    // さかのぼって表示している間は、同じ行を表示し続ける。
+    // 最も古い行が捨てられて同じ行を表示できないときは表示が 1 行ずれる。
+    if (scroll_ > 0 && scroll_ < MaxScroll()) {
+        ++scroll_;
+        return;
+    }
+    // 描画は Render で描画済みの内容を 1 行上へ移動して行う
+    ++pending_shift_;
+}
+
+void Console::MoveCursor(int row, int column) {
+    row = std::clamp(row, 0, rows_ - 1);
+    column = std::clamp(column, 0, columns_ - 1);
+    // まだ行の無い位置へ移動するときは、そこまで空の行を追加する
+    while (bottom_row_ < row) {
+        AppendLine();
     }
-}
\ No newline at end of file
+    cursor_row_ = row;
+    cursor_column_ = column;
+}
+
+void Console::EraseCells(int first, int last) {
+    Cell* line = CursorLine();
+    last = std::min(last, columns_);
+    if (first >= last) {
+        return;
+    }
+    BreakWideChar(line, first);
+    BreakWideChar(line, last - 1);
+    FillCells(line + first, last - first, {'\0', kDefaultFG, bg_});
+}
+
+void Console::BreakWideChar(Cell* line, int column) {
+    if (line[column].c == kWideTail && column > 0) {
+        line[column - 1].c = '\0';
+        line[column].c = '\0';
+    } else if (IsFullWidth(line[column].c) && column + 1 < columns_) {
+        line[column].c = '\0';
+        line[column + 1].c = '\0';
+    }
+}
@@ -1,20 +1,197 @@
 #pragma once 
 
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+#include "error.hpp"
+#include "font.hpp"
 #include "graphics.hpp" 
+#include "layer.hpp"
 
+/** @brief 文字を行単位で表示するコンソール.
+ *
+ * 行数と桁数は描画先の大きさから決まる。
+ * 行はリングバッファに保持し、画面外へ流れた行も Scroll でさかのぼって表示できる。
+ *
+ * PutString や Scroll は文字の表を更新するだけで描画はしない。
+ * 描画は Render でまとめて行い、前回の描画から変わったセルだけを描き直す。
+ *
+ * PutString は VT100 のエスケープシーケンスのうち次のものを解釈する。
+ * - ESC [ n ; ... m : 文字の色を変える (SGR)。
+ *   0, 1, 22, 30-37, 39, 40-47, 49, 90-97, 100-107 に対応する
+ * - ESC [ row ; column H (または f) : カーソルを移動する (1 始まり)
+ * - ESC [ n K : 行を消去する。
+ *   0 はカーソルから行末、1 は行頭からカーソル、2 は行全体
+ * また '\r' でカーソルを行頭へ戻す。
+ * 文字列は UTF-8 として解釈し、全角文字は 2 桁分の幅で表示する。
+ */
 class Console {
     public:
-        static const int kRows=25, kColumns=80;
+        /** @brief 画面外へ流れた行を保持しておく既定の行数 */
+        static const int kDefaultScrollbackLines = 1000;
+
+        /** @brief 1 文字分のセル. 色は色番号で持つ.
+         *
+         * 全角文字は 2 つのセルを使い、右側のセルの文字は kWideTail になる。
+         */
+        struct Cell {
+            char32_t c;   // ヌル文字は空白を表す
+            uint8_t fg;   // 描画色の色番号
+            uint8_t bg;   // 背景色の色番号
+
+            bool operator==(const Cell& rhs) const {
+                return c == rhs.c && fg == rhs.fg && bg == rhs.bg;
+            }
+        };
+
+        /** @brief 色番号. 0-15 は ANSI の 16 色. 既定の描画色と背景色は別に持つ */
+        static const uint8_t kDefaultFG = 16, kDefaultBG = 17;
+        static const int kNumColors = 18;
+        /** @brief 全角文字の右側のセルを表す文字 */
+        static const char32_t kWideTail = 0xffffffff;
+
+        /** Writer の具象型 (FrameBufferWriter<kFormat>) を渡すと、
+         * 文字描画はその型向けに実体化された WriteGlyph で行われる。
+         * 文字は glyphs_ で描画色と背景色に展開済みのものを複写して描く。
+         * 行数と桁数は writer の描画先に収まる最大の値になる。
+         * fg_color, bg_color は既定の描画色と背景色。
+         * 文字は縦横 font_scale 倍に拡大して表示する (ChooseFontScale を参照)。
+         */
+        template <class Writer>
+        Console(Writer& writer,
+            const PixelColor& fg_color, const PixelColor& bg_color,
+            int font_scale = 1)
+            : writer_{writer},
+            write_glyph_{[](PixelWriter& w, int x, int y,
+                            const uint32_t* glyph, int width, int height) {
+                WriteGlyph(static_cast<Writer&>(w), x, y, glyph, width,
+                           height);
+            }},
+            fg_color_{fg_color}, bg_color_{bg_color},
+            font_scale_{std::clamp(font_scale, 1, GlyphCache::kMaxScale)},
+            rows_{static_cast<int>(writer.Config().vertical_resolution) /
+                  (GlyphCache::kGlyphHeight * font_scale_)},
+            columns_{static_cast<int>(writer.Config().horizontal_resolution) /
+                     (GlyphCache::kGlyphWidth * font_scale_)} {
+        }
+
+        /** @brief 行を保持するリングバッファと、文字を展開する領域を確保する.
+         *
+         * 画面に表示する行に加えて scrollback_lines 行をさかのぼって表示できる。
+         * 確保するまでは PutString は何もしない。
+         *
+         * @return 確保できなかった場合は Error::kNoEnoughMemory
+         */
+        Error Initialize(int scrollback_lines = kDefaultScrollbackLines);
 
-        Console(PixelWriter& writer,
-            const PixelColor& fg_color, const PixelColor& bg_color);
         void PutString(const char* s);
+        /** @brief s の先頭 len バイトを書く. 途中にヌル文字があればそこまで */
+        void PutString(const char* s, size_t len);
+
+        /** @brief writer の描画先となっているレイヤーを設定する.
+         *
+         * 設定すると Render のたびに描き直したセルを合成し、画面へ転送する。
+         */
+        void SetLayer(LayerManager* layer_manager, unsigned int layer_id);
+
+        /** @brief 表示を lines 行だけ過去へさかのぼる. 負なら新しい方へ戻す.
+         *
+         * 表示できるのは保持している最も古い行から最新の行まで。
+         * さかのぼっている間に出力された行は、表示を動かさずに保持だけする。
+         */
+        void Scroll(int lines);
+        /** @brief 1 画面分さかのぼる */
+        void PageUp() { Scroll(rows_ - 1); }
+        /** @brief 1 画面分新しい方へ戻す */
+        void PageDown() { Scroll(-(rows_ - 1)); }
+
+        /** @brief 前回の描画以降の変更を描画する.
+         *
+         * 表示が行単位でずれた分はまず描画済みの内容を移動し、
+         * その後で文字か色が変わったセルだけを描き直す。
+         * 変更がなければ何もしないので、メインループの空き時間に毎回呼んでよい。
+         */
+        void Render();
+
+        /** @brief カーソルの表示と非表示を切り替える.
+         *
+         * カーソルはその位置のセルの描画色と背景色を入れ替えて表す。
+         * 表示をさかのぼっている間は表示しない。描画は次の Render で行う。
+         */
+        void ToggleCursor();
+
+        int Rows() const { return rows_; }
+        int Columns() const { return columns_; }
 
     private:
+        enum class EscapeState { kNone, kEscape, kCsi };
+        static const int kMaxParams = 8;
+
+        void PutChar(char32_t c);
+        /** @brief ESC [ に続く最後の文字 c に応じた処理をする */
+        void ExecuteCsi(char32_t c);
+        void SelectGraphicRendition();
+        /** @brief i 番目の引数. 省略されているか 0 なら default_value */
+        int Param(int i, int default_value) const;
+
         void Newline();
+        /** @brief 最新の行の次に空の行を追加する */
+        void AppendLine();
+        /** @brief カーソルを画面上の row 行 column 列目へ移動する */
+        void MoveCursor(int row, int column);
+        /** @brief カーソルのある行の [first, last) 列目を消去する */
+        void EraseCells(int first, int last);
+        /** @brief line の column 列目が全角文字の一部なら、その全角文字を空白にする */
+        void BreakWideChar(Cell* line, int column);
+
+        /** @brief セル cell を row 行 column 列目に描く */
+        void WriteCell(int row, int column, const Cell& cell);
+        /** @brief 描画済みの内容を shift 行だけ上へ (負なら下へ) 移動する */
+        void ShiftShown(int shift);
+        /** @brief 最新の行から back 行前の行. 保持していなければ nullptr */
+        Cell* Line(int back);
+        Cell* CursorLine() { return Line(bottom_row_ - cursor_row_); }
+        /** @brief さかのぼれる最大の行数 */
+        int MaxScroll() const;
+        void MarkDirtyRows(int first_row, int num_rows);
+        Cell BlankCell() const { return {'\0', kDefaultFG, kDefaultBG}; }
 
         PixelWriter& writer_;
+        void (*const write_glyph_)(PixelWriter& writer, int x, int y,
+                                   const uint32_t* glyph, int width,
+                                   int height);
         const PixelColor fg_color_, bg_color_;
-        char buffer_[kRows][kColumns+1];
-        int cursor_row_, cursor_column_;
-};
\ No newline at end of file
+        // 色番号ごとの Pack 済みのピクセル値
+        std::array<uint32_t, kNumColors> palette_{};
+        GlyphCache glyphs_;
+        const int font_scale_;
+        const int rows_, columns_;
+
+        // 行のリングバッファ. 各行は columns_ 個のセルからなる
+        Cell* lines_ = nullptr;
+        int capacity_ = 0;    // リングバッファの行数
+        int last_line_ = 0;   // 最新の行の位置
+        int num_lines_ = 0;   // 保持している行数
+        int scroll_ = 0;      // 表示をさかのぼっている行数
+        int bottom_row_ = 0;  // 最新の行を表示する画面上の行
+
+        // 描画済みのセルの表 (rows_ x columns_)
+        Cell* shown_ = nullptr;
+        // 前回の描画以降に、表示が上へずれた行数 (下へずれたなら負)
+        int pending_shift_ = 0;
+        bool dirty_ = false;
+
+        int cursor_row_ = 0, cursor_column_ = 0;
+        bool cursor_shown_ = false;
+        // 以降に書く文字の色番号
+        uint8_t fg_ = kDefaultFG, bg_ = kDefaultBG;
+        bool bold_ = false;
+
+        EscapeState escape_state_ = EscapeState::kNone;
+        std::array<int, kMaxParams> params_{};
+        int num_params_ = 0;
+
+        LayerManager* layer_manager_ = nullptr;
+        unsigned int layer_id_ = 0;
+};
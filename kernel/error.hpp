@@ -26,6 +26,8 @@ class Error {
         kInvalidPhase,
         kUnknownXHCISpeedID,
         kNoWaiter,
+        kNoPCIMSI,
+        kTimeout,
         kLastOfCode,  // この列挙子は常に最後に配置する
     };
 
@@ -51,6 +53,8 @@ class Error {
         "kInvalidPhase",
         "kUnknownXHCISpeedID",
         "kNoWaiter",
+        "kNoPCIMSI",
+        "kTimeout",
     };
     static_assert(Error::Code::kLastOfCode == code_names_.size());
 
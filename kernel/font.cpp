@@ -1,40 +1,287 @@
 #include "font.hpp"
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// hankaku.txt から tools/makefont.py --header で生成される
+#include "hankaku.hpp"
 
 // どこか他のオブジェクトファイルにある変数を参照するとコンパイラに伝える
-extern const uint8_t _binary_hankaku_bin_start;
-extern const uint8_t _binary_hankaku_bin_end;
-extern const uint8_t _binary_hankaku_bin_size;
+// 全角フォントのアトラス. 形式は tools/makefont.py を参照
+extern const uint8_t _binary_zenkaku_bin_start;
+extern const uint8_t _binary_zenkaku_bin_size;
+
+namespace {
+    const char32_t kReplacementCharacter = 0xfffd;
+    const uint16_t kAtlasNone = 0xffff;
+
+    uint16_t Read16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+    uint32_t Read32(const uint8_t* p) {
+        return Read16(p) | (static_cast<uint32_t>(Read16(p + 2)) << 16);
+    }
+
+    /** @brief 文字 cp を表す半角フォントの番号. 無ければ '?' の番号 */
+    uint8_t HankakuIndex(char32_t cp) {
+        if (cp < 0x80) {
+            return cp;
+        }
+        // 半角カナは JIS X 0201 の位置 (0xa1-0xdf) にある
+        if (0xff61 <= cp && cp <= 0xff9f) {
+            return cp - 0xff61 + 0xa1;
+        }
+        return '?';
+    }
+
+    /** @brief 幅 width のビットマップ rows を、1 のビットだけ color で書く.
+     *
+     * 最初にクリップ矩形と交差させ、内側のループでは範囲チェックをしない。
+     */
+    template <class Writer, class Row>
+    void WriteBitmap(Writer& writer, int x, int y, int width, const Row* rows,
+                     const PixelColor& color) {
+        const auto area = Rectangle<int>{{x, y}, {width, 16}} & writer.Clip();
+        if (IsEmpty(area)) {
+            return;
+        }
+        const int left = area.pos.x - x;
+        const int top = area.pos.y - y;
+        const unsigned int msb = 1u << (width - 1);
+        const uint32_t value = writer.Pack(color);
+        for (int dy = top; dy < top + area.size.y; dy++) {
+            uint32_t* row = writer.PixelAt(x, y + dy);
+            for (int dx = left; dx < left + area.size.x; dx++) {
+                if ((static_cast<unsigned int>(rows[dy]) << dx) & msb) {
+                    row[dx] = value;
+                }
+            }
+        }
+    }
+}  // namespace
 
 
 const uint8_t* GetFont(char c) {
-    // bin_startからのポインタのオフセット値を表している。
-    // このオフセット値が、bin_sizeよりも大きくなると、ぬるぽを返す。
-    auto index = 16 * static_cast<unsigned int>(c);
-    if (index >= reinterpret_cast<uintptr_t>(&_binary_hankaku_bin_size)) {
+    // 256 文字すべてのビットマップがあるので範囲チェックは要らない
+    return font_data::kHankaku[static_cast<uint8_t>(c)];
+}
+
+int DecodeUtf8(const char* s, size_t len, char32_t& cp) {
+    const auto* u = reinterpret_cast<const uint8_t*>(s);
+    if (len == 0 || u[0] == 0) {
+        return 0;
+    }
+    if (u[0] < 0x80) {
+        cp = u[0];
+        return 1;
+    }
+
+    size_t length;
+    char32_t min_cp;
+    if ((u[0] & 0xe0) == 0xc0) {
+        length = 2, min_cp = 0x80, cp = u[0] & 0x1f;
+    } else if ((u[0] & 0xf0) == 0xe0) {
+        length = 3, min_cp = 0x800, cp = u[0] & 0x0f;
+    } else if ((u[0] & 0xf8) == 0xf0) {
+        length = 4, min_cp = 0x10000, cp = u[0] & 0x07;
+    } else {
+        cp = kReplacementCharacter;
+        return 1;
+    }
+
+    for (size_t i = 1; i < length; ++i) {
+        // 途中で終わっている場合もここで弾かれる
+        if (i >= len || (u[i] & 0xc0) != 0x80) {
+            cp = kReplacementCharacter;
+            return 1;
+        }
+        cp = (cp << 6) | (u[i] & 0x3f);
+    }
+    // 冗長な表現やサロゲート、範囲外のものは不正とする
+    if (cp < min_cp || cp > 0x10ffff || (0xd800 <= cp && cp <= 0xdfff)) {
+        cp = kReplacementCharacter;
+        return 1;
+    }
+    return static_cast<int>(length);
+}
+
+bool IsFullWidth(char32_t cp) {
+    // East Asian Width が W または F の主な範囲
+    return (0x1100 <= cp && cp <= 0x115f) || (0x2e80 <= cp && cp <= 0x303e) ||
+           (0x3041 <= cp && cp <= 0x33ff) || (0x3400 <= cp && cp <= 0x4dbf) ||
+           (0x4e00 <= cp && cp <= 0x9fff) || (0xa000 <= cp && cp <= 0xa4cf) ||
+           (0xac00 <= cp && cp <= 0xd7a3) || (0xf900 <= cp && cp <= 0xfaff) ||
+           (0xfe30 <= cp && cp <= 0xfe4f) || (0xff00 <= cp && cp <= 0xff60) ||
+           (0xffe0 <= cp && cp <= 0xffe6) || (0x20000 <= cp && cp <= 0x3fffd);
+}
+
+bool GetZenkakuFont(char32_t cp, std::array<uint16_t, 16>& rows) {
+    rows.fill(0);
+
+    const uint8_t* atlas = &_binary_zenkaku_bin_start;
+    const auto atlas_size =
+        reinterpret_cast<uintptr_t>(&_binary_zenkaku_bin_size);
+    // ページ番号の表 (コードポイントの上位 8 ビット) とページ内の表 (下位 8 ビット)
+    // の 2 段で引くので、文字の数によらず一定の時間で見つかる
+    if (cp <= 0xffff && atlas_size >= 8 + 2 * 256 &&
+        memcmp(atlas, "ZKA1", 4) == 0) {
+        const int num_pages = Read16(atlas + 4);
+        const int num_glyphs = Read16(atlas + 6);
+        const uint8_t* page_of = atlas + 8;
+        const uint8_t* pages = page_of + 2 * 256;
+        const uint8_t* offsets = pages + 2 * 256 * num_pages;
+        const uint8_t* glyph_data = offsets + 4 * num_glyphs;
+
+        const uint16_t page = Read16(page_of + 2 * (cp >> 8));
+        const uint16_t glyph =
+            page == kAtlasNone ? kAtlasNone
+                               : Read16(pages + 2 * (256 * page + (cp & 0xff)));
+        if (glyph != kAtlasNone) {
+            // 上下の空白行を除いた行だけが入っている
+            const uint8_t* data = glyph_data + Read32(offsets + 4 * glyph);
+            const int top = data[0];
+            const int height = data[1];
+            for (int i = 0; i < height && top + i < 16; ++i) {
+                rows[top + i] = (data[2 + 2 * i] << 8) | data[3 + 2 * i];
+            }
+            return true;
+        }
+    }
+
+    // フォントの無い文字は豆腐で表す
+    rows[1] = rows[14] = 0x7ffe;
+    for (int i = 2; i < 14; ++i) {
+        rows[i] = 0x4002;
+    }
+    return false;
+}
+
+int ChooseFontScale(const FrameBufferConfig& config) {
+    const int kMinRows = 33;
+    const int scale =
+        config.vertical_resolution / (GlyphCache::kGlyphHeight * kMinRows);
+    return std::clamp(scale, 1, GlyphCache::kMaxScale);
+}
+
+Error GlyphCache::Initialize(int scale) {
+    scale = std::clamp(scale, 1, kMaxScale);
+    const int narrow_size = kGlyphWidth * kGlyphHeight * scale * scale;
+    const int wide_size = 2 * narrow_size;
+    const size_t num_entries = kSets * kWays;
+    auto narrow = reinterpret_cast<uint32_t*>(
+        malloc(sizeof(uint32_t) * narrow_size * num_entries));
+    auto wide = reinterpret_cast<uint32_t*>(
+        malloc(sizeof(uint32_t) * wide_size * num_entries));
+    if (narrow == nullptr || wide == nullptr) {
+        free(narrow);
+        free(wide);
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+
+    free(narrow_.pixels);
+    free(wide_.pixels);
+    scale_ = scale;
+    narrow_ = Table{{}, narrow, narrow_size};
+    wide_ = Table{{}, wide, wide_size};
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+const uint32_t* GlyphCache::Get(char32_t cp, uint32_t fg_pixel,
+                                uint32_t bg_pixel) {
+    auto& table = IsFullWidth(cp) ? wide_ : narrow_;
+    if (table.pixels == nullptr) {
         return nullptr;
     }
-    return &_binary_hankaku_bin_start + index;
+
+    ++clock_;
+    const int set = (cp + 3 * fg_pixel + 5 * bg_pixel) % kSets;
+    int victim = kWays * set;
+    for (int i = kWays * set; i < kWays * (set + 1); ++i) {
+        auto& entry = table.entries[i];
+        if (entry.valid && entry.cp == cp && entry.fg_pixel == fg_pixel &&
+            entry.bg_pixel == bg_pixel) {
+            entry.last_used = clock_;
+            return table.pixels + table.glyph_size * i;
+        }
+        const auto& v = table.entries[victim];
+        if (!entry.valid || (v.valid && entry.last_used < v.last_used)) {
+            victim = i;
+        }
+    }
+
+    // セット内で空いているか、最も長く使われていないものと入れ替える
+    uint32_t* pixels = table.pixels + table.glyph_size * victim;
+    Expand(cp, fg_pixel, bg_pixel, pixels);
+    table.entries[victim] = {cp, fg_pixel, bg_pixel, true, clock_};
+    return pixels;
 }
 
-// 参照で渡す
-void WriteAscii(PixelWriter& writer, int x, int y, char c, const PixelColor& color) {
-    const uint8_t* font = GetFont(c);
-    if (font == nullptr) {
-        return;
+void GlyphCache::Expand(char32_t cp, uint32_t fg_pixel, uint32_t bg_pixel,
+                        uint32_t* dst) const {
+    const bool wide = IsFullWidth(cp);
+    const int bits_width = wide ? 2 * kGlyphWidth : kGlyphWidth;
+    const int width = bits_width * scale_;
+
+    std::array<uint16_t, 16> wide_rows;
+    const uint8_t* narrow_rows = nullptr;
+    if (wide) {
+        GetZenkakuFont(cp, wide_rows);
+    } else {
+        narrow_rows = GetFont(HankakuIndex(cp));
     }
 
-    for (int dy = 0; dy < 16; dy++) {
-        for (int dx = 0; dx < 8; dx++) {
-            if ((font[dy] << dx) & 0x80u) {
-                writer.Write(x + dx, y+dy, color);
+    for (int dy = 0; dy < kGlyphHeight; ++dy) {
+        uint32_t* row = dst + width * scale_ * dy;
+        if (wide) {
+            const unsigned int bits = wide_rows[dy];
+            for (int bx = 0; bx < bits_width; ++bx) {
+                const uint32_t pixel =
+                    ((bits << bx) & 0x8000u) ? fg_pixel : bg_pixel;
+                FillPixels(row + scale_ * bx, pixel, scale_);
+            }
+        } else {
+            // 行ごとのマスクで描画色と背景色を選ぶので、ビットごとの分岐は無い
+            const uint32_t* masks = font_data::kRowMasks[narrow_rows[dy]];
+            for (int bx = 0; bx < bits_width; ++bx) {
+                const uint32_t pixel =
+                    (fg_pixel & masks[bx]) | (bg_pixel & ~masks[bx]);
+                FillPixels(row + scale_ * bx, pixel, scale_);
             }
         }
+        // 縦方向の拡大は、できた行を複写するだけ
+        for (int k = 1; k < scale_; ++k) {
+            MovePixels(row + width * k, row, width);
+        }
     }
 }
 
-void WriteString(PixelWriter& writer, int x, int y, const char* s, const PixelColor& color) {
-    for (int i = 0; s[i] != '\0'; i++) {
-        WriteAscii(writer, x+8*i, y, s[i], color);
+// 参照で渡す
+template <class Writer>
+void WriteAscii(Writer& writer, int x, int y, char c, const PixelColor& color) {
+    WriteBitmap(writer, x, y, 8, GetFont(c), color);
+}
+
+template <class Writer>
+void WriteString(Writer& writer, int x, int y, const char* s, const PixelColor& color) {
+    char32_t cp;
+    while (int length = DecodeUtf8(s, cp)) {
+        s += length;
+        if (IsFullWidth(cp)) {
+            std::array<uint16_t, 16> rows;
+            GetZenkakuFont(cp, rows);
+            WriteBitmap(writer, x, y, 16, rows.data(), color);
+            x += 16;
+        } else {
+            WriteAscii(writer, x, y, HankakuIndex(cp), color);
+            x += 8;
+        }
     }
-}
\ No newline at end of file
+}
+
+// 描画先として使う Writer の型ごとに明示的に実体化する
+#define INSTANTIATE_FONT_FUNCTIONS(Writer) \
+    template void WriteAscii(Writer&, int, int, char, const PixelColor&); \
+    template void WriteString(Writer&, int, int, const char*, const PixelColor&);
+
+INSTANTIATE_FONT_FUNCTIONS(PixelWriter)
+INSTANTIATE_FONT_FUNCTIONS(RGBResv8BitPerColorPixelWriter)
+INSTANTIATE_FONT_FUNCTIONS(BGRResv8BitPerColorPixelWriter)
@@ -1,7 +1,121 @@
 #pragma once 
 
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include "error.hpp"
+#include "frame_buffer_config.hpp"
 #include "graphics.hpp"
 
-void WriteAscii(PixelWriter& writer, int x, int y, char c, const PixelColor& color);
-void WriteString(PixelWriter& writer, int x, int y, const char* s, const PixelColor& color);
\ No newline at end of file
+/** @brief 文字 c のフォントデータ (16 バイト) の先頭を返す. */
+const uint8_t* GetFont(char c);
+
+/** @brief s の先頭の UTF-8 の 1 文字を復号して cp に書き、使ったバイト数を返す.
+ *
+ * s の先頭 len バイトより先は読まない。
+ * 不正なバイト列は 1 バイトずつ U+FFFD として復号する。
+ * len が 0 か s が空文字列なら 0 を返す。
+ */
+int DecodeUtf8(const char* s, size_t len, char32_t& cp);
+/** @brief ヌル終端された s の先頭の 1 文字を復号する */
+inline int DecodeUtf8(const char* s, char32_t& cp) {
+    return DecodeUtf8(s, SIZE_MAX, cp);
+}
+
+/** @brief 全角 (半角 2 文字分の幅) で表示する文字なら true */
+bool IsFullWidth(char32_t cp);
+
+/** @brief 全角文字 cp のフォントデータ (16 x 16) を rows に書く.
+ *
+ * rows の各要素が 1 行で、最上位ビットが左端のピクセル。
+ * 全角フォントのアトラスに無い文字なら豆腐 (四角) を書いて false を返す。
+ */
+bool GetZenkakuFont(char32_t cp, std::array<uint16_t, 16>& rows);
+
+// Writer の型ごとに実体化される (font.cpp で明示的に実体化している)
+template <class Writer>
+void WriteAscii(Writer& writer, int x, int y, char c, const PixelColor& color);
+/** s は UTF-8 で、全角文字は半角 2 文字分の幅で書く */
+template <class Writer>
+void WriteString(Writer& writer, int x, int y, const char* s, const PixelColor& color);
+
+/** @brief 画面の大きさに合わせたコンソールの文字の倍率 (1-4) を返す.
+ *
+ * 縦に少なくとも 33 行 (倍率 1 で 528 ピクセル) 並ぶ範囲で最も大きい倍率にする。
+ * 縦 1056 ピクセル未満は 1 倍、1584 未満は 2 倍、2112 未満は 3 倍、
+ * それ以上は 4 倍なので、1080p は 2 倍、4K (2160) は 4 倍になる。
+ */
+int ChooseFontScale(const FrameBufferConfig& config);
+
+/** @brief 各文字を描画色と背景色のピクセル値へ展開したものを保持する.
+ *
+ * 展開済みの文字は WriteImage で行を複写するだけで描けるので、
+ * フォントのビットを 1 つずつ調べる必要がない。
+ * 文字は縦横 Scale() 倍に拡大して展開するので、倍率によらず描画は行の複写だけで済む。
+ *
+ * 展開したものは (文字, 色の組) ごとに保持する。
+ * 半角文字と全角文字で別々に kSets x kWays 個のセット アソシアティブな表を持ち、
+ * セット内で最も長く使われていないものから捨てる。
+ */
+class GlyphCache {
+   public:
+    /** @brief 倍率 1 のときの半角文字の大きさ */
+    static const int kGlyphWidth = 8, kGlyphHeight = 16;
+    static const int kMaxScale = 4;
+    static const int kSets = 32, kWays = 4;
+
+    /** @brief 縦横 scale 倍に拡大した文字を展開するための領域を確保する.
+     *
+     * 展開済みの文字はすべて捨てる。
+     *
+     * @return 確保できなかった場合は Error::kNoEnoughMemory
+     */
+    Error Initialize(int scale);
+
+    int Scale() const { return scale_; }
+    /** @brief 半角 1 文字分の大きさ (ピクセル) */
+    int CellWidth() const { return kGlyphWidth * scale_; }
+    int CellHeight() const { return kGlyphHeight * scale_; }
+    /** @brief 文字 cp を表示する幅 (ピクセル) */
+    int GlyphWidth(char32_t cp) const {
+        return (IsFullWidth(cp) ? 2 : 1) * CellWidth();
+    }
+
+    /** @brief 文字 cp を展開したピクセル値 (GlyphWidth(cp) x CellHeight()).
+     *
+     * fg_pixel, bg_pixel は PixelWriter::Pack で変換済みの値。
+     * Initialize する前は nullptr を返す。
+     */
+    const uint32_t* Get(char32_t cp, uint32_t fg_pixel, uint32_t bg_pixel);
+
+   private:
+    struct Entry {
+        char32_t cp;
+        uint32_t fg_pixel, bg_pixel;
+        bool valid;
+        uint64_t last_used;
+    };
+
+    /** @brief 同じ幅の文字を展開したものの表 */
+    struct Table {
+        std::array<Entry, kSets * kWays> entries;
+        // entries[i] の文字のピクセル値は pixels + glyph_size * i から
+        uint32_t* pixels;
+        int glyph_size;
+    };
+
+    int scale_{1};
+    Table narrow_{}, wide_{};
+    uint64_t clock_{0};
+
+    /** @brief 文字 cp を縦横 scale_ 倍にして dst に展開する */
+    void Expand(char32_t cp, uint32_t fg_pixel, uint32_t bg_pixel,
+                uint32_t* dst) const;
+};
+
+/** @brief GlyphCache で展開済みの大きさ width x height の文字 glyph を (x, y) に描く */
+template <class Writer>
+void WriteGlyph(Writer& writer, int x, int y, const uint32_t* glyph,
+                int width, int height) {
+    WriteImage(writer, {x, y}, {width, height}, glyph);
+}
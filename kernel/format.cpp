@@ -0,0 +1,363 @@
+#include "format.hpp"
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+    /** @brief 書き出したバイト数を数えながら、limit を超えないように sink へ渡す */
+    class Output {
+       public:
+        Output(FormatSink& sink, size_t limit) : sink_{sink}, rest_{limit} {}
+
+        void Put(const char* s, size_t len) {
+            if (len > rest_) {
+                // 溢れる場合は、切れ目にかかる UTF-8 の文字ごと捨てる
+                len = rest_;
+                while (len > 0 && (s[len] & 0xc0) == 0x80) {
+                    --len;
+                }
+                rest_ = len;
+            }
+            if (len == 0) {
+                return;
+            }
+            sink_.Write(s, len);
+            rest_ -= len;
+            written_ += len;
+        }
+
+        void Fill(char c, int n) {
+            char pad[16];
+            memset(pad, c, sizeof(pad));
+            for (; n > 0; n -= sizeof(pad)) {
+                Put(pad, n < static_cast<int>(sizeof(pad)) ? n : sizeof(pad));
+            }
+        }
+
+        int Written() const { return written_; }
+
+       private:
+        FormatSink& sink_;
+        size_t rest_;
+        int written_{0};
+    };
+
+    /** @brief 1 つの変換指定の内容 */
+    struct Spec {
+        bool left = false;  // '-'
+        bool zero = false;  // '0'
+        int width = 0;
+        int precision = -1;  // 指定が無ければ -1
+        int length = 0;      // hh: -2, h: -1, l: 1, ll: 2, z: 3
+    };
+
+    const char kLowerDigits[] = "0123456789abcdef";
+    const char kUpperDigits[] = "0123456789ABCDEF";
+
+    /** @brief 00 から 99 までの 2 桁の数字を並べた表 */
+    const char kDigitPairs[] =
+        "00010203040506070809101112131415161718192021222324"
+        "25262728293031323334353637383940414243444546474849"
+        "50515253545556575859606162636465666768697071727374"
+        "75767778798081828384858687888990919293949596979899";
+
+    /** @brief value を end の手前へ逆順に書き、先頭を返す.
+     *
+     * 基数は定数なので、除算は乗算とシフトに置き換わる。
+     * 2 桁ずつ表を引いて除算の回数を半分にし、
+     * 32 ビットに収まる部分は 32 ビットの演算で済ませる。
+     */
+    char* FormatDecimal(char* end, uint64_t value) {
+        while (value > UINT32_MAX) {
+            const unsigned int pair = value % 100;
+            value /= 100;
+            end -= 2;
+            memcpy(end, &kDigitPairs[2 * pair], 2);
+        }
+        uint32_t v = value;
+        while (v >= 100) {
+            const unsigned int pair = v % 100;
+            v /= 100;
+            end -= 2;
+            memcpy(end, &kDigitPairs[2 * pair], 2);
+        }
+        if (v >= 10) {
+            end -= 2;
+            memcpy(end, &kDigitPairs[2 * v], 2);
+        } else {
+            *--end = '0' + v;
+        }
+        return end;
+    }
+
+    char* FormatHex(char* end, uint64_t value, const char* digits) {
+        do {
+            *--end = digits[value & 0xf];
+            value >>= 4;
+        } while (value);
+        return end;
+    }
+
+    /** @brief 符号や "0x" の prefix と数字列 digits を、幅と精度に合わせて書く */
+    void PutNumber(Output& out, const Spec& spec, const char* prefix,
+                   const char* digits, int num_digits) {
+        const int prefix_len = strlen(prefix);
+        // 精度は最小の桁数. 値 0 を精度 0 で書くと何も出ない
+        int zeros = spec.precision > num_digits ? spec.precision - num_digits
+                                                : 0;
+        if (spec.precision == 0 && num_digits == 1 && digits[0] == '0') {
+            num_digits = 0;
+        }
+        int pad = spec.width - prefix_len - zeros - num_digits;
+        if (spec.zero && !spec.left && spec.precision < 0 && pad > 0) {
+            zeros += pad;
+            pad = 0;
+        }
+
+        if (!spec.left) {
+            out.Fill(' ', pad);
+        }
+        out.Put(prefix, prefix_len);
+        out.Fill('0', zeros);
+        out.Put(digits, num_digits);
+        if (spec.left) {
+            out.Fill(' ', pad);
+        }
+    }
+
+    int64_t SignedArg(const Spec& spec, va_list& ap) {
+        switch (spec.length) {
+            case -2:
+                return static_cast<signed char>(va_arg(ap, int));
+            case -1:
+                return static_cast<short>(va_arg(ap, int));
+            case 0:
+                return va_arg(ap, int);
+            case 1:
+                return va_arg(ap, long);
+            case 3:
+                return va_arg(ap, ptrdiff_t);
+            default:
+                return va_arg(ap, long long);
+        }
+    }
+
+    uint64_t UnsignedArg(const Spec& spec, va_list& ap) {
+        switch (spec.length) {
+            case -2:
+                return static_cast<unsigned char>(va_arg(ap, unsigned int));
+            case -1:
+                return static_cast<unsigned short>(va_arg(ap, unsigned int));
+            case 0:
+                return va_arg(ap, unsigned int);
+            case 1:
+                return va_arg(ap, unsigned long);
+            case 3:
+                return va_arg(ap, size_t);
+            default:
+                return va_arg(ap, unsigned long long);
+        }
+    }
+
+    /** @brief format の '%' の直後から変換指定を読み、spec に入れる.
+     *
+     * @return 変換指定子 (d, x など) の位置
+     */
+    const char* ParseSpec(const char* p, Spec& spec, va_list& ap) {
+        for (;; ++p) {
+            if (*p == '-') {
+                spec.left = true;
+            } else if (*p == '0') {
+                spec.zero = true;
+            } else {
+                break;
+            }
+        }
+
+        if (*p == '*') {
+            spec.width = va_arg(ap, int);
+            if (spec.width < 0) {
+                spec.left = true;
+                spec.width = -spec.width;
+            }
+            ++p;
+        }
+        for (; '0' <= *p && *p <= '9'; ++p) {
+            spec.width = spec.width * 10 + (*p - '0');
+        }
+
+        if (*p == '.') {
+            ++p;
+            spec.precision = 0;
+            if (*p == '*') {
+                spec.precision = va_arg(ap, int);
+                ++p;
+            }
+            for (; '0' <= *p && *p <= '9'; ++p) {
+                spec.precision = spec.precision * 10 + (*p - '0');
+            }
+        }
+
+        if (*p == 'h') {
+            ++p;
+            spec.length = -1;
+            if (*p == 'h') {
+                ++p;
+                spec.length = -2;
+            }
+        } else if (*p == 'l') {
+            ++p;
+            spec.length = 1;
+            if (*p == 'l') {
+                ++p;
+                spec.length = 2;
+            }
+        } else if (*p == 'z') {
+            ++p;
+            spec.length = 3;
+        }
+        return p;
+    }
+
+    /** @brief 固定長のバッファへ書き込む FormatSink. 溢れないことは Output が保証する */
+    class BufferSink : public FormatSink {
+       public:
+        BufferSink(char* buf) : p_{buf} {}
+        void Write(const char* s, size_t len) override {
+            memcpy(p_, s, len);
+            p_ += len;
+        }
+
+       private:
+        char* p_;
+    };
+}  // namespace
+
+int VFormat(FormatSink& sink, size_t limit, const char* format, va_list ap) {
+    Output out{sink, limit};
+    // 64 ビットの 10 進数でも 20 桁に収まる
+    char buf[24];
+    char* const buf_end = buf + sizeof(buf);
+
+    va_list args;
+    va_copy(args, ap);
+    const char* p = format;
+    while (*p) {
+        // 次の '%' までの地の文はまとめて書き出す
+        const char* text = p;
+        while (*p && *p != '%') {
+            ++p;
+        }
+        out.Put(text, p - text);
+        if (*p == '\0') {
+            break;
+        }
+
+        const char* conversion = p++;
+        Spec spec;
+        p = ParseSpec(p, spec, args);
+
+        switch (*p) {
+            case 'd':
+            case 'i': {
+                const int64_t value = SignedArg(spec, args);
+                const uint64_t magnitude =
+                    value < 0 ? -static_cast<uint64_t>(value) : value;
+                char* digits = FormatDecimal(buf_end, magnitude);
+                PutNumber(out, spec, value < 0 ? "-" : "", digits,
+                          buf_end - digits);
+                break;
+            }
+            case 'u': {
+                char* digits = FormatDecimal(buf_end, UnsignedArg(spec, args));
+                PutNumber(out, spec, "", digits, buf_end - digits);
+                break;
+            }
+            case 'x':
+            case 'X': {
+                char* digits =
+                    FormatHex(buf_end, UnsignedArg(spec, args),
+                              *p == 'x' ? kLowerDigits : kUpperDigits);
+                PutNumber(out, spec, "", digits, buf_end - digits);
+                break;
+            }
+            case 'p': {
+                const auto value =
+                    reinterpret_cast<uintptr_t>(va_arg(args, void*));
+                char* digits = FormatHex(buf_end, value, kLowerDigits);
+                PutNumber(out, spec, "0x", digits, buf_end - digits);
+                break;
+            }
+            case 's': {
+                const char* s = va_arg(args, const char*);
+                if (s == nullptr) {
+                    s = "(null)";
+                }
+                size_t len = 0;
+                // 精度があればそれより先は読まない (ヌル終端されていなくてよい)
+                while ((spec.precision < 0 ||
+                        len < static_cast<size_t>(spec.precision)) &&
+                       s[len]) {
+                    ++len;
+                }
+                const int pad = spec.width - static_cast<int>(len);
+                if (!spec.left) {
+                    out.Fill(' ', pad);
+                }
+                out.Put(s, len);
+                if (spec.left) {
+                    out.Fill(' ', pad);
+                }
+                break;
+            }
+            case 'c': {
+                buf[0] = static_cast<char>(va_arg(args, int));
+                const int pad = spec.width - 1;
+                if (!spec.left) {
+                    out.Fill(' ', pad);
+                }
+                out.Put(buf, 1);
+                if (spec.left) {
+                    out.Fill(' ', pad);
+                }
+                break;
+            }
+            case '%':
+                out.Put("%", 1);
+                break;
+            default:
+                // 対応していない変換指定はそのまま書き出す
+                out.Put(conversion, p - conversion);
+                continue;
+        }
+        ++p;
+    }
+    va_end(args);
+    return out.Written();
+}
+
+int Format(FormatSink& sink, size_t limit, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    const int result = VFormat(sink, limit, format, ap);
+    va_end(ap);
+    return result;
+}
+
+int VFormatString(char* buf, size_t size, const char* format, va_list ap) {
+    if (size == 0) {
+        return 0;
+    }
+    BufferSink sink{buf};
+    const int result = VFormat(sink, size - 1, format, ap);
+    buf[result] = '\0';
+    return result;
+}
+
+int FormatString(char* buf, size_t size, const char* format, ...) {
+    va_list ap;
+    va_start(ap, format);
+    const int result = VFormatString(buf, size, format, ap);
+    va_end(ap);
+    return result;
+}
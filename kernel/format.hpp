@@ -0,0 +1,45 @@
+/**
+ * @file format.hpp
+ *
+ * printk や Log で使う、動的確保をしない printf 互換の書式化を提供する。
+ */
+
+#pragma once
+
+#include <cstdarg>
+#include <cstddef>
+
+/** @brief 書式化した文字列の出力先.
+ *
+ * 書式文字列の地の文や %s の文字列はまとめて 1 回の Write で渡すので、
+ * UTF-8 の 1 文字が 2 回の Write に分かれることはない。
+ */
+class FormatSink {
+   public:
+    virtual ~FormatSink() = default;
+    /** @brief s から len バイトを書き出す. s はヌル終端されていない */
+    virtual void Write(const char* s, size_t len) = 0;
+};
+
+/** @brief format に従って書式化した結果を sink へ書き出す.
+ *
+ * 対応する変換指定は %d %i %u %x %X %p %s %c %% で、
+ * フラグ '-' と '0'、最小幅 (数値または '*')、精度、長さ修飾子 h hh l ll z。
+ * それ以外の変換指定は書式文字列のまま出力する。
+ * 書き出すのは最大 limit バイトまでで、あふれる場合は UTF-8 の文字の
+ * 途中で切らないように、その文字の手前で打ち切る。
+ *
+ * @return sink へ書き出したバイト数
+ */
+int VFormat(FormatSink& sink, size_t limit, const char* format, va_list ap);
+int Format(FormatSink& sink, size_t limit, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
+
+/** @brief 書式化した結果を大きさ size のバッファ buf へ書き込む.
+ *
+ * snprintf と違い、戻り値は切り詰めた後の長さ (ヌル文字を除く)。
+ * size が 1 以上なら buf は必ずヌル終端される。
+ */
+int VFormatString(char* buf, size_t size, const char* format, va_list ap);
+int FormatString(char* buf, size_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
@@ -4,38 +4,141 @@ PixelWriterクラスなどはここに置く。
 */
 #include "graphics.hpp"
 
-void RGBResv8BitPerColorPixelWriter::Write(int x, int y, const PixelColor& c) {
-    auto p = PixelAt(x, y);
-    p[0] = c.r;
-    p[1] = c.g;
-    p[2] = c.b;
-}
+#include <algorithm>
+
+namespace {
+#if defined(__SSE2__)
+    // 4 ピクセル (16 バイト) をまとめて扱うためのベクタ型
+    typedef uint32_t Pixel4 __attribute__((vector_size(16)));
+    // 16 バイト境界に揃っていないアドレスを読み書きするためのベクタ型
+    typedef uint32_t UnalignedPixel4
+        __attribute__((vector_size(16), aligned(4)));
+#endif
+
+    uint32_t* RowAt(const FrameBufferConfig& config, int x, int y) {
+        return reinterpret_cast<uint32_t*>(config.frame_buffer) +
+               config.pixels_per_scan_line * y + x;
+    }
+
+    /** @brief RGB と BGR の間でピクセル値を変換する (R と B を入れ替える) */
+    uint32_t SwapRedBlue(uint32_t pixel) {
+        return (pixel & 0xff00ff00u) | ((pixel & 0xffu) << 16) |
+               ((pixel >> 16) & 0xffu);
+    }
+}  // namespace
 
-void BGRResv8BitPerColorPixelWriter::Write(int x, int y, const PixelColor& c) {
-    auto p = PixelAt(x, y);
-    p[0] = c.b;
-    p[1] = c.g;
-    p[2] = c.r;
+void FillPixels(uint32_t* dst, uint32_t value, int n) {
+#if defined(__SSE2__)
+    // 16 バイト境界に揃うまでは 1 ピクセルずつ書く
+    while (n > 0 && (reinterpret_cast<uintptr_t>(dst) & 0xfu)) {
+        *dst++ = value;
+        --n;
+    }
+    const Pixel4 v = {value, value, value, value};
+    for (; n >= 8; n -= 8, dst += 8) {
+        reinterpret_cast<Pixel4*>(dst)[0] = v;
+        reinterpret_cast<Pixel4*>(dst)[1] = v;
+    }
+    if (n >= 4) {
+        *reinterpret_cast<Pixel4*>(dst) = v;
+        dst += 4;
+        n -= 4;
+    }
+#endif
+    for (; n > 0; --n) {
+        *dst++ = value;
+    }
 }
 
-void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
-                   const Vector2D<int>& size, const PixelColor& c) {
-    // 中が塗られない四角形を描画する関数
-    for (int dx = 0; dx < size.x; dx++) {
-        writer.Write(pos.x + dx, pos.y, c);
-        writer.Write(pos.x + dx, pos.y + size.y - 1, c);
+void MovePixels(uint32_t* dst, const uint32_t* src, int n) {
+    if (dst == src || n <= 0) {
+        return;
+    }
+
+    if (dst < src || dst >= src + n) {
+        // 前から複写しても、まだ読んでいない部分を上書きすることはない
+#if defined(__SSE2__)
+        for (; n >= 8; n -= 8, dst += 8, src += 8) {
+            const UnalignedPixel4 v0 =
+                reinterpret_cast<const UnalignedPixel4*>(src)[0];
+            const UnalignedPixel4 v1 =
+                reinterpret_cast<const UnalignedPixel4*>(src)[1];
+            reinterpret_cast<UnalignedPixel4*>(dst)[0] = v0;
+            reinterpret_cast<UnalignedPixel4*>(dst)[1] = v1;
+        }
+#endif
+        for (; n > 0; --n) {
+            *dst++ = *src++;
+        }
+        return;
+    }
+
+    // dst が src の後ろで重なっているので、後ろから複写する
+    dst += n;
+    src += n;
+#if defined(__SSE2__)
+    for (; n >= 8; n -= 8) {
+        dst -= 8;
+        src -= 8;
+        const UnalignedPixel4 v0 =
+            reinterpret_cast<const UnalignedPixel4*>(src)[0];
+        const UnalignedPixel4 v1 =
+            reinterpret_cast<const UnalignedPixel4*>(src)[1];
+        reinterpret_cast<UnalignedPixel4*>(dst)[1] = v1;
+        reinterpret_cast<UnalignedPixel4*>(dst)[0] = v0;
     }
-    for (int dy = 1; dy < size.y - 1; dy++) {
-        writer.Write(pos.x, pos.y + dy, c);
-        writer.Write(pos.x + size.x - 1, pos.y + dy, c);
+#endif
+    for (; n > 0; --n) {
+        *--dst = *--src;
     }
 }
 
-void FillRectangle(PixelWriter& writer, const Vector2D<int>& pos,
-                   const Vector2D<int>& size, const PixelColor& c) {
-    for (int dy = 0; dy < size.y; dy++) {
-        for (int dx = 0; dx < size.x; dx++) {
-            writer.Write(pos.x + dx, pos.y + dy, c);
+void CopyRect(const FrameBufferConfig& dst, Vector2D<int> dst_pos,
+              const FrameBufferConfig& src, const Rectangle<int>& src_area) {
+    Vector2D<int> src_pos = src_area.pos;
+    Vector2D<int> size = src_area.size;
+
+    // 左上が src, dst の範囲外なら、はみ出した分だけ両方の位置をずらす
+    const int shift_x = std::max({0, -src_pos.x, -dst_pos.x});
+    const int shift_y = std::max({0, -src_pos.y, -dst_pos.y});
+    src_pos += Vector2D<int>{shift_x, shift_y};
+    dst_pos += Vector2D<int>{shift_x, shift_y};
+    size.x -= shift_x;
+    size.y -= shift_y;
+
+    // 右下のはみ出しを切り詰める
+    const int src_width = src.horizontal_resolution;
+    const int src_height = src.vertical_resolution;
+    const int dst_width = dst.horizontal_resolution;
+    const int dst_height = dst.vertical_resolution;
+    size.x = std::min({size.x, src_width - src_pos.x, dst_width - dst_pos.x});
+    size.y = std::min({size.y, src_height - src_pos.y, dst_height - dst_pos.y});
+    if (size.x <= 0 || size.y <= 0) {
+        return;
+    }
+    TRACE(kTraceCopyRect, size.x, size.y);
+
+    // 同じバッファ内で下へずらす場合は、下の行から複写しないと
+    // まだ読んでいない行を上書きしてしまう
+    const bool bottom_up =
+        dst.frame_buffer == src.frame_buffer && dst_pos.y > src_pos.y;
+    const bool same_format = dst.pixel_format == src.pixel_format;
+
+    for (int i = 0; i < size.y; ++i) {
+        const int dy = bottom_up ? size.y - 1 - i : i;
+        uint32_t* dst_row = RowAt(dst, dst_pos.x, dst_pos.y + dy);
+        const uint32_t* src_row = RowAt(src, src_pos.x, src_pos.y + dy);
+        if (same_format) {
+            MovePixels(dst_row, src_row, size.x);
+        } else {
+            for (int dx = 0; dx < size.x; ++dx) {
+                dst_row[dx] = SwapRedBlue(src_row[dx]);
+            }
         }
     }
-}
\ No newline at end of file
+}
+
+void MoveRect(const FrameBufferConfig& config, Vector2D<int> dst_pos,
+              const Rectangle<int>& src_area) {
+    CopyRect(config, dst_pos, config, src_area);
+}
@@ -3,55 +3,269 @@
 */
 #pragma once
 
+#include <algorithm>
+
 #include "frame_buffer_config.hpp"
+#include "trace.hpp"
 
 struct PixelColor {
     uint8_t r, g, b;
 };
 
+// vector 2D
+template <typename T>
+struct Vector2D {
+    T x, y;
+
+    template <typename U>
+    Vector2D<T>& operator+=(const Vector2D<U>& rhs) {
+        x += rhs.x;
+        y += rhs.y;
+        return *this;
+    }
+};
+
+/** @brief pos を左上とする大きさ size の矩形 */
+template <typename T>
+struct Rectangle {
+    Vector2D<T> pos, size;
+};
+
+/** @brief 大きさが 0 以下の (何も含まない) 矩形なら true */
+template <typename T>
+bool IsEmpty(const Rectangle<T>& r) {
+    return r.size.x <= 0 || r.size.y <= 0;
+}
+
+/** @brief a と b が重なる部分を返す. 重ならなければ IsEmpty になる */
+template <typename T>
+Rectangle<T> operator&(const Rectangle<T>& a, const Rectangle<T>& b) {
+    const T left = std::max(a.pos.x, b.pos.x);
+    const T top = std::max(a.pos.y, b.pos.y);
+    const T right = std::min(a.pos.x + a.size.x, b.pos.x + b.size.x);
+    const T bottom = std::min(a.pos.y + a.size.y, b.pos.y + b.size.y);
+    return {{left, top}, {right - left, bottom - top}};
+}
+
+/** @brief ピクセルフォーマットごとの色の変換方法を表す。
+ *
+ * フォーマットごとに特殊化され、コンパイル時に変換方法が決まる。
+ */
+template <PixelFormat kFormat>
+struct PixelFormatTraits;
+
+template <>
+struct PixelFormatTraits<kPixelRGBResv8BitPerColor> {
+    // メモリ上で r, g, b, 予約 の順に並ぶ (リトルエンディアン)
+    static constexpr uint32_t Pack(const PixelColor& c) {
+        return c.r | (c.g << 8) | (c.b << 16);
+    }
+};
+
+template <>
+struct PixelFormatTraits<kPixelBGRResv8BitPerColor> {
+    static constexpr uint32_t Pack(const PixelColor& c) {
+        return c.b | (c.g << 8) | (c.r << 16);
+    }
+};
+
+/** @brief dst から n ピクセルをピクセル値 value で埋める。
+ *
+ * SSE2 が使える場合は 16 バイト単位のストアでまとめて書き込む。
+ */
+void FillPixels(uint32_t* dst, uint32_t value, int n);
+
+/** @brief src から n ピクセルを dst へ複写する.
+ *
+ * 2 つの範囲が重なっていてもよい (memmove と同じ)。
+ * SSE2 が使える場合は 16 バイト単位で読み書きする。
+ */
+void MovePixels(uint32_t* dst, const uint32_t* src, int n);
+
+/** @brief src の src_area の範囲を、dst の dst_pos を左上とする位置へ複写する.
+ *
+ * src と dst の範囲外にはみ出す部分は複写しない。
+ * src と dst は同じバッファでもよく、範囲が重なっていても正しく複写する。
+ * ピクセルフォーマットが同じなら行ごとに MovePixels で複写し、
+ * 異なれば 1 ピクセルずつ変換する。
+ */
+void CopyRect(const FrameBufferConfig& dst, Vector2D<int> dst_pos,
+              const FrameBufferConfig& src, const Rectangle<int>& src_area);
+
+/** @brief config の src_area の範囲を dst_pos を左上とする位置へ移動する.
+ *
+ * 移動元と移動先が重なっていてもよい。移動元に残った部分はそのままになる。
+ */
+void MoveRect(const FrameBufferConfig& config, Vector2D<int> dst_pos,
+              const Rectangle<int>& src_area);
+
+/** @brief フレームバッファへの描画を行う.
+ *
+ * 描画はクリップ矩形 Clip() の内側に限られる。
+ * 各描画関数は最初に一度だけ描画範囲をクリップ矩形と交差させ、
+ * 内側のループでは範囲チェックをしない。
+ * クリップ矩形の初期値はフレームバッファ全体。
+ */
 class PixelWriter {
    public:
-    PixelWriter(const FrameBufferConfig& config) : config_{config} {}
+    PixelWriter(const FrameBufferConfig& config)
+        : config_{config}, clip_{Bounds()} {}
     virtual ~PixelWriter() = default;
     virtual void Write(int x, int y, const PixelColor& c) = 0;
 
+    /** @brief 色をフレームバッファ上の 32 ビットのピクセル値に変換する。 */
+    virtual uint32_t Pack(const PixelColor& c) = 0;
+
+    /** @brief (x, y) から右へ len ピクセルを色 c で塗りつぶす。 */
+    virtual void FillSpan(int x, int y, int len, const PixelColor& c) = 0;
+    /** @brief pos を左上とする大きさ size の矩形を色 c で塗りつぶす。 */
+    virtual void FillRect(const Vector2D<int>& pos, const Vector2D<int>& size,
+                          const PixelColor& c) = 0;
+    /** @brief (x, y) から右へ len ピクセル分のピクセル値を書き込む。
+     *
+     * @param pixels Pack で変換済みのピクセル値の配列
+     */
+    virtual void WriteRow(int x, int y, const uint32_t* pixels, int len) = 0;
+
+    /** @brief 描画先のフレームバッファの設定 */
+    const FrameBufferConfig& Config() const { return config_; }
+
+    /** @brief フレームバッファ全体を表す矩形 */
+    Rectangle<int> Bounds() const {
+        return {{0, 0},
+                {static_cast<int>(config_.horizontal_resolution),
+                 static_cast<int>(config_.vertical_resolution)}};
+    }
+
+    /** @brief 描画を許す範囲を area に制限する. フレームバッファの外は常に除かれる */
+    void SetClip(const Rectangle<int>& area) { clip_ = area & Bounds(); }
+    /** @brief クリップ矩形をフレームバッファ全体に戻す */
+    void ResetClip() { clip_ = Bounds(); }
+    const Rectangle<int>& Clip() const { return clip_; }
+
+    /** @brief (x, y) のピクセルへのポインタ.
+     *
+     * 範囲チェックをしないので、(x, y) が Clip() の内側であることを
+     * 呼び出し側で保証すること。
+     */
+    uint32_t* PixelAt(int x, int y) {
+        return reinterpret_cast<uint32_t*>(config_.frame_buffer) +
+               config_.pixels_per_scan_line * y + x;
+    }
+
    protected:
-    uint8_t* PixelAt(int x, int y) {
-        return config_.frame_buffer +
-               4 * (config_.pixels_per_scan_line * y + x);
+    bool InClip(int x, int y) const {
+        return clip_.pos.x <= x && x < clip_.pos.x + clip_.size.x &&
+               clip_.pos.y <= y && y < clip_.pos.y + clip_.size.y;
     }
 
    private:
     const FrameBufferConfig& config_;
+    Rectangle<int> clip_;
 };
 
-class RGBResv8BitPerColorPixelWriter : public PixelWriter {
+/** @brief ピクセルフォーマットをテンプレート引数に取る PixelWriter.
+ *
+ * final クラスなので、具象型のまま使えば仮想関数呼び出しを経由せず
+ * 各メンバ関数がインライン展開される。
+ * フォーマットの判定は KernelMain で一度だけ行う。
+ */
+template <PixelFormat kFormat>
+class FrameBufferWriter final : public PixelWriter {
    public:
     using PixelWriter::PixelWriter;
-    virtual void Write(int x, int y, const PixelColor& c) override;
-};
 
-class BGRResv8BitPerColorPixelWriter : public PixelWriter {
-   public:
-    using PixelWriter::PixelWriter;
+    void Write(int x, int y, const PixelColor& c) override {
+        if (InClip(x, y)) {
+            *PixelAt(x, y) = Pack(c);
+        }
+    }
 
-    virtual void Write(int x, int y, const PixelColor& c) override;
-};
+    uint32_t Pack(const PixelColor& c) override {
+        return PixelFormatTraits<kFormat>::Pack(c);
+    }
 
-// vector 2D
-template <typename T>
-struct Vector2D {
-    T x, y;
+    void FillSpan(int x, int y, int len, const PixelColor& c) override {
+        const auto area = Rectangle<int>{{x, y}, {len, 1}} & Clip();
+        if (IsEmpty(area)) {
+            return;
+        }
+        // 色の変換は 1 スパンにつき 1 回だけ行い、後は 32 ビット単位で書き込む
+        FillPixels(PixelAt(area.pos.x, y), Pack(c), area.size.x);
+    }
 
-    template <typename U>
-    Vector2D<T>& operator+=(const Vector2D<U>& rhs) {
-        x += rhs.x;
-        y += rhs.y;
-        return *this;
+    void FillRect(const Vector2D<int>& pos, const Vector2D<int>& size,
+                  const PixelColor& c) override {
+        const auto area = Rectangle<int>{pos, size} & Clip();
+        if (IsEmpty(area)) {
+            return;
+        }
+        TRACE(kTraceFillRect, area.size.x, area.size.y);
+        const uint32_t value = Pack(c);
+        for (int dy = 0; dy < area.size.y; ++dy) {
+            FillPixels(PixelAt(area.pos.x, area.pos.y + dy), value,
+                       area.size.x);
+        }
+    }
+
+    void WriteRow(int x, int y, const uint32_t* pixels, int len) override {
+        const auto area = Rectangle<int>{{x, y}, {len, 1}} & Clip();
+        if (IsEmpty(area)) {
+            return;
+        }
+        // 左側で切り詰めた分だけ読み出し位置を進める
+        pixels += area.pos.x - x;
+        uint32_t* dst = PixelAt(area.pos.x, y);
+        for (int i = 0; i < area.size.x; ++i) {
+            dst[i] = pixels[i];
+        }
     }
 };
 
-void DrawRectangle(PixelWriter& writer, const Vector2D<int>& pos,
-                   const Vector2D<int>& size, const PixelColor& c);
-void FillRectangle(PixelWriter& writer, const Vector2D<int>& pos,
-                   const Vector2D<int>& size, const PixelColor& c);
+using RGBResv8BitPerColorPixelWriter =
+    FrameBufferWriter<kPixelRGBResv8BitPerColor>;
+using BGRResv8BitPerColorPixelWriter =
+    FrameBufferWriter<kPixelBGRResv8BitPerColor>;
+
+/* 以下の描画関数は Writer の型ごとに実体化される。
+ * Writer に FrameBufferWriter<kFormat> を渡せば内側のループまで
+ * インライン展開され、PixelWriter を渡せば仮想関数経由で動作する。
+ */
+
+template <class Writer>
+void DrawRectangle(Writer& writer, const Vector2D<int>& pos,
+                   const Vector2D<int>& size, const PixelColor& c) {
+    // 中が塗られない四角形を描画する関数
+    // 上下の辺はスパンとしてまとめて塗り、左右の辺だけ 1 ピクセルずつ書く
+    writer.FillSpan(pos.x, pos.y, size.x, c);
+    writer.FillSpan(pos.x, pos.y + size.y - 1, size.x, c);
+    for (int dy = 1; dy < size.y - 1; dy++) {
+        writer.Write(pos.x, pos.y + dy, c);
+        writer.Write(pos.x + size.x - 1, pos.y + dy, c);
+    }
+}
+
+template <class Writer>
+void FillRectangle(Writer& writer, const Vector2D<int>& pos,
+                   const Vector2D<int>& size, const PixelColor& c) {
+    writer.FillRect(pos, size, c);
+}
+
+/** @brief pos を左上とする大きさ size の範囲へ Pack 済みのピクセル値を書き込む.
+ *
+ * pixels は 1 行 size.x ピクセルずつ、行の順に並んだ配列。
+ * クリップ矩形との交差は最初に一度だけ求め、後は行ごとに複写する。
+ */
+template <class Writer>
+void WriteImage(Writer& writer, const Vector2D<int>& pos,
+                const Vector2D<int>& size, const uint32_t* pixels) {
+    const auto area = Rectangle<int>{pos, size} & writer.Clip();
+    if (IsEmpty(area)) {
+        return;
+    }
+    pixels += size.x * (area.pos.y - pos.y) + (area.pos.x - pos.x);
+    for (int dy = 0; dy < area.size.y; ++dy) {
+        MovePixels(writer.PixelAt(area.pos.x, area.pos.y + dy),
+                   pixels + size.x * dy, area.size.x);
+    }
+}
@@ -0,0 +1,35 @@
+#include "heap.hpp"
+
+#include <cstdint>
+
+// newlib_support.c の sbrk が参照する
+extern "C" {
+uintptr_t program_break, program_break_end;
+}
+
+Error InitializeHeap(const MemoryMap& memory_map) {
+    const auto buffer_begin = reinterpret_cast<uintptr_t>(memory_map.buffer);
+    const auto buffer_end = buffer_begin + memory_map.map_size;
+
+    // ブートサービス用の領域には UEFI から引き継いだスタックが残っているので、
+    // 空き領域 (EfiConventionalMemory) だけを候補にする。
+    uintptr_t best_start = 0;
+    uint64_t best_pages = 0;
+    for (uintptr_t iter = buffer_begin; iter < buffer_end;
+         iter += memory_map.descriptor_size) {
+        auto desc = reinterpret_cast<const MemoryDescriptor*>(iter);
+        if (desc->type == MemoryType::kEfiConventionalMemory &&
+            desc->physical_start != 0 && desc->number_of_pages > best_pages) {
+            best_start = desc->physical_start;
+            best_pages = desc->number_of_pages;
+        }
+    }
+
+    if (best_pages == 0) {
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+
+    program_break = best_start;
+    program_break_end = best_start + best_pages * kUEFIPageSize;
+    return MAKE_ERROR(Error::kSuccess);
+}
@@ -0,0 +1,20 @@
+/**
+ * @file heap.hpp
+ *
+ * newlib の malloc が使うヒープ領域 (プログラムブレーク) を用意する。
+ */
+
+#pragma once
+
+#include "error.hpp"
+#include "memory_map.hpp"
+
+/** @brief メモリマップから空き領域を探し、ヒープとして使えるようにする。
+ *
+ * UEFI のメモリマップ上で最も大きい EfiConventionalMemory の領域を
+ * sbrk が払い出す範囲として設定する。
+ * これ以降 malloc や new でメモリを確保できるようになる。
+ *
+ * @return 使える領域が見つからなければ Error::kNoEnoughMemory
+ */
+Error InitializeHeap(const MemoryMap& memory_map);
@@ -0,0 +1,58 @@
+#include "interrupt.hpp"
+
+#include "asmfunc.h"
+
+std::array<InterruptDescriptor, 256> idt;
+
+namespace {
+    const uintptr_t kLocalAPICBase = 0xfee00000;
+    const uintptr_t kLocalAPICID = kLocalAPICBase + 0x20;
+    const uintptr_t kLocalAPICEOI = kLocalAPICBase + 0xb0;
+
+    const uintptr_t kIOAPICBase = 0xfec00000;
+    const uintptr_t kIOAPICIndex = kIOAPICBase + 0x00;
+    const uintptr_t kIOAPICData = kIOAPICBase + 0x10;
+    // リダイレクションテーブルのエントリ n は 0x10 + 2n と 0x11 + 2n にある
+    const uint32_t kIOAPICRedirectionTable = 0x10;
+
+    // 8259 のマスタとスレーブの割り込みマスクレジスタ
+    const uint16_t kPICMasterData = 0x21;
+    const uint16_t kPICSlaveData = 0xa1;
+
+    volatile uint32_t& MMIO32(uintptr_t addr) {
+        return *reinterpret_cast<volatile uint32_t*>(addr);
+    }
+
+    void WriteIOAPIC(uint32_t index, uint32_t value) {
+        MMIO32(kIOAPICIndex) = index;
+        MMIO32(kIOAPICData) = value;
+    }
+}  // namespace
+
+void SetIDTEntry(InterruptDescriptor& desc, InterruptDescriptorAttribute attr,
+                 uint64_t offset, uint16_t segment_selector) {
+    desc.attr = attr;
+    desc.offset_low = offset & 0xffffu;
+    desc.offset_middle = (offset >> 16) & 0xffffu;
+    desc.offset_high = offset >> 32;
+    desc.segment_selector = segment_selector;
+}
+
+void InitializeInterrupt() {
+    // I/O APIC を使うので、8259 からの割り込みはすべてマスクしておく
+    IoOut8(kPICMasterData, 0xff);
+    IoOut8(kPICSlaveData, 0xff);
+
+    LoadIDT(sizeof(idt) - 1, reinterpret_cast<uintptr_t>(&idt[0]));
+}
+
+void NotifyEndOfInterrupt() { MMIO32(kLocalAPICEOI) = 0; }
+
+uint8_t LocalAPICID() { return MMIO32(kLocalAPICID) >> 24; }
+
+void RouteISAInterrupt(int irq, uint8_t vector) {
+    const uint32_t index = kIOAPICRedirectionTable + 2 * irq;
+    // 上位: 割り込み先の APIC ID. 下位: 固定配送, 物理宛先, エッジ, High アクティブ
+    WriteIOAPIC(index + 1, static_cast<uint32_t>(LocalAPICID()) << 24);
+    WriteIOAPIC(index, vector);
+}
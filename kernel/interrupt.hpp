@@ -0,0 +1,132 @@
+/**
+ * @file interrupt.hpp
+ *
+ * 割り込みの設定 (IDT, Local APIC, I/O APIC) を行う。
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+enum class DescriptorType {
+    kUpper8Bytes = 0,
+    kLDT = 2,
+    kTSSAvailable = 9,
+    kTSSBusy = 11,
+    kCallGate = 12,
+    kInterruptGate = 14,
+    kTrapGate = 15,
+};
+
+union InterruptDescriptorAttribute {
+    uint16_t data;
+    struct {
+        uint16_t interrupt_stack_table : 3;
+        uint16_t : 5;
+        DescriptorType type : 4;
+        uint16_t : 1;
+        uint16_t descriptor_privilege_level : 2;
+        uint16_t present : 1;
+    } __attribute__((packed)) bits;
+} __attribute__((packed));
+
+struct InterruptDescriptor {
+    uint16_t offset_low;
+    uint16_t segment_selector;
+    InterruptDescriptorAttribute attr;
+    uint16_t offset_middle;
+    uint32_t offset_high;
+    uint32_t reserved;
+} __attribute__((packed));
+
+extern std::array<InterruptDescriptor, 256> idt;
+
+constexpr InterruptDescriptorAttribute MakeIDTAttr(
+    DescriptorType type, uint8_t descriptor_privilege_level,
+    bool present = true, uint8_t interrupt_stack_table = 0) {
+    InterruptDescriptorAttribute attr{};
+    attr.bits.interrupt_stack_table = interrupt_stack_table;
+    attr.bits.type = type;
+    attr.bits.descriptor_privilege_level = descriptor_privilege_level;
+    attr.bits.present = present;
+    return attr;
+}
+
+void SetIDTEntry(InterruptDescriptor& desc, InterruptDescriptorAttribute attr,
+                 uint64_t offset, uint16_t segment_selector);
+
+/** @brief 割り込みベクタの割り当て.
+ *
+ * 0x00 から 0x1f は CPU の例外に予約されているので、それより後ろを使う。
+ */
+class InterruptVector {
+   public:
+    enum Number {
+        kXHCI = 0x40,
+        kSerial = 0x41,
+        kLAPICTimer = 0x42,
+    };
+};
+
+/** @brief 割り込みハンドラに渡される、CPU が積んだ割り込み前の状態 */
+struct InterruptFrame {
+    uint64_t rip;
+    uint64_t cs;
+    uint64_t rflags;
+    uint64_t rsp;
+    uint64_t ss;
+};
+
+/** @brief 割り込みが許可されて (RFLAGS.IF が立って) いれば true */
+inline bool InterruptsEnabled() {
+    uint64_t rflags;
+    __asm__ volatile("pushfq\n\tpop %0" : "=r"(rflags) : : "memory");
+    return rflags & (1u << 9);
+}
+
+/** @brief 生存している間は割り込みを禁止する.
+ *
+ * 破棄されるときに、作られる前の割り込み許可フラグ (RFLAGS.IF) に戻すので、
+ * 割り込みハンドラの中や、既に禁止されている所で使っても構わない。
+ */
+class InterruptGuard {
+   public:
+    InterruptGuard() {
+        __asm__ volatile("pushfq\n\tpop %0\n\tcli"
+                         : "=r"(rflags_)
+                         :
+                         : "memory");
+    }
+    ~InterruptGuard() {
+        if (rflags_ & kRFLAGSInterruptEnable) {
+            __asm__ volatile("sti" : : : "memory");
+        }
+    }
+    InterruptGuard(const InterruptGuard&) = delete;
+    InterruptGuard& operator=(const InterruptGuard&) = delete;
+
+   private:
+    static const uint64_t kRFLAGSInterruptEnable = 1u << 9;
+    uint64_t rflags_;
+};
+
+/** @brief IDT を CPU に登録し、レガシー PIC (8259) の割り込みを止める.
+ *
+ * 各ベクタのハンドラは、呼ぶ前に SetIDTEntry で idt に書いておく。
+ */
+void InitializeInterrupt();
+
+/** @brief 割り込み処理の終わりを Local APIC に通知する. ハンドラの最後に呼ぶ */
+void NotifyEndOfInterrupt();
+
+/** @brief この CPU の Local APIC ID */
+uint8_t LocalAPICID();
+
+/** @brief ISA の IRQ 番号 irq の割り込みを、I/O APIC で vector に振り向ける.
+ *
+ * ACPI の MADT は読まないので、I/O APIC は標準の 0xfec00000 にあり、
+ * ISA の IRQ 番号がそのまま GSI 番号になっていると仮定する。
+ * 割り込み先はこの関数を呼んだ CPU。
+ */
+void RouteISAInterrupt(int irq, uint8_t vector);
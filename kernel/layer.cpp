@@ -0,0 +1,316 @@
+#include "layer.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+    /** @brief 1 回の合成で扱う矩形の断片の最大数. 超えたら遮蔽判定を諦める */
+    const int kMaxPieces = 32;
+
+    /** @brief 矩形の断片を最大 kMaxPieces 個まで保持する */
+    struct PieceList {
+        std::array<Rectangle<int>, kMaxPieces> pieces;
+        int num_pieces = 0;
+
+        /** @return 空きがなければ false */
+        bool Push(const Rectangle<int>& r) {
+            if (IsEmpty(r)) {
+                return true;
+            }
+            if (num_pieces == kMaxPieces) {
+                return false;
+            }
+            pieces[num_pieces++] = r;
+            return true;
+        }
+    };
+
+    /** @brief outer から inner (outer に含まれる) を除いた部分を最大 4 つの矩形で返す */
+    bool Subtract(const Rectangle<int>& outer, const Rectangle<int>& inner,
+                  PieceList& result) {
+        const int outer_right = outer.pos.x + outer.size.x;
+        const int outer_bottom = outer.pos.y + outer.size.y;
+        const int inner_right = inner.pos.x + inner.size.x;
+        const int inner_bottom = inner.pos.y + inner.size.y;
+
+        return result.Push(
+                   {outer.pos, {outer.size.x, inner.pos.y - outer.pos.y}}) &&
+               result.Push({{outer.pos.x, inner_bottom},
+                            {outer.size.x, outer_bottom - inner_bottom}}) &&
+               result.Push({{outer.pos.x, inner.pos.y},
+                            {inner.pos.x - outer.pos.x, inner.size.y}}) &&
+               result.Push({{inner_right, inner.pos.y},
+                            {outer_right - inner_right, inner.size.y}});
+    }
+
+    /** @brief どのレイヤーにも覆われていない部分を黒で塗る */
+    void FillBlack(const FrameBufferConfig& dst, const Rectangle<int>& area) {
+        for (int dy = 0; dy < area.size.y; ++dy) {
+            auto row = reinterpret_cast<uint32_t*>(dst.frame_buffer) +
+                       dst.pixels_per_scan_line * (area.pos.y + dy) +
+                       area.pos.x;
+            FillPixels(row, 0, area.size.x);
+        }
+    }
+}  // namespace
+
+Layer::Layer(unsigned int id) : id_{id} {}
+
+Layer::~Layer() { free(config_.frame_buffer); }
+
+Error Layer::Initialize(int width, int height, PixelFormat format) {
+    const size_t bytes = 4 * static_cast<size_t>(width) * height;
+    auto buffer = reinterpret_cast<uint8_t*>(malloc(bytes));
+    if (buffer == nullptr) {
+        return MAKE_ERROR(Error::kNoEnoughMemory);
+    }
+    memset(buffer, 0, bytes);
+
+    free(config_.frame_buffer);
+    config_.frame_buffer = buffer;
+    config_.pixels_per_scan_line = width;
+    config_.horizontal_resolution = width;
+    config_.vertical_resolution = height;
+    config_.pixel_format = format;
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void Layer::SetTransparentPixel(uint32_t pixel) {
+    transparent_ = true;
+    transparent_pixel_ = pixel;
+}
+
+void Layer::DrawTo(const FrameBufferConfig& dst,
+                   const Rectangle<int>& area) const {
+    const int src_x = area.pos.x - pos_.x;
+    const int src_y = area.pos.y - pos_.y;
+
+    if (!transparent_) {
+        CopyRect(dst, area.pos, config_, {{src_x, src_y}, area.size});
+        return;
+    }
+
+    for (int dy = 0; dy < area.size.y; ++dy) {
+        auto src_row = reinterpret_cast<const uint32_t*>(config_.frame_buffer) +
+                       config_.pixels_per_scan_line * (src_y + dy) + src_x;
+        auto dst_row = reinterpret_cast<uint32_t*>(dst.frame_buffer) +
+                       dst.pixels_per_scan_line * (area.pos.y + dy) +
+                       area.pos.x;
+        for (int dx = 0; dx < area.size.x; ++dx) {
+            if (src_row[dx] != transparent_pixel_) {
+                dst_row[dx] = src_row[dx];
+            }
+        }
+    }
+}
+
+void LayerManager::SetBackBuffer(BackBuffer* back_buffer) {
+    back_buffer_ = back_buffer;
+}
+
+Layer* LayerManager::NewLayer(int width, int height) {
+    if (num_layers_ == kMaxLayers) {
+        return nullptr;
+    }
+
+    auto layer = new Layer{static_cast<unsigned int>(num_layers_ + 1)};
+    if (layer->Initialize(width, height,
+                          back_buffer_->Config().pixel_format)) {
+        delete layer;
+        return nullptr;
+    }
+    layers_[num_layers_++] = layer;
+    return layer;
+}
+
+void LayerManager::UpDown(unsigned int id, int new_height) {
+    Layer* layer = FindLayer(id);
+    if (layer == nullptr) {
+        return;
+    }
+    if (new_height < 0) {
+        Hide(id);
+        return;
+    }
+
+    const int old_height = HeightOf(layer);
+    if (old_height >= 0) {
+        std::copy(layer_stack_.begin() + old_height + 1,
+                  layer_stack_.begin() + stack_height_,
+                  layer_stack_.begin() + old_height);
+        --stack_height_;
+    }
+
+    new_height = std::min(new_height, stack_height_);
+    std::copy_backward(layer_stack_.begin() + new_height,
+                       layer_stack_.begin() + stack_height_,
+                       layer_stack_.begin() + stack_height_ + 1);
+    layer_stack_[new_height] = layer;
+    ++stack_height_;
+
+    MarkDirtyScreen(layer->Area());
+}
+
+void LayerManager::Hide(unsigned int id) {
+    Layer* layer = FindLayer(id);
+    const int height = HeightOf(layer);
+    if (height < 0) {
+        return;
+    }
+
+    std::copy(layer_stack_.begin() + height + 1,
+              layer_stack_.begin() + stack_height_,
+              layer_stack_.begin() + height);
+    --stack_height_;
+    MarkDirtyScreen(layer->Area());
+}
+
+void LayerManager::Move(unsigned int id, Vector2D<int> pos) {
+    Layer* layer = FindLayer(id);
+    if (layer == nullptr) {
+        return;
+    }
+
+    const bool visible = HeightOf(layer) >= 0;
+    if (visible) {
+        MarkDirtyScreen(layer->Area());
+    }
+    layer->Move(pos);
+    if (visible) {
+        MarkDirtyScreen(layer->Area());
+    }
+}
+
+void LayerManager::MoveRelative(unsigned int id, Vector2D<int> displacement) {
+    Layer* layer = FindLayer(id);
+    if (layer == nullptr) {
+        return;
+    }
+
+    auto pos = layer->Position();
+    pos += displacement;
+    Move(id, pos);
+}
+
+void LayerManager::MarkDirty(unsigned int id, const Rectangle<int>& area) {
+    Layer* layer = FindLayer(id);
+    if (HeightOf(layer) < 0) {
+        return;
+    }
+
+    const auto layer_pos = layer->Position();
+    MarkDirtyScreen({{layer_pos.x + area.pos.x, layer_pos.y + area.pos.y},
+                     area.size});
+}
+
+void LayerManager::Draw() {
+    TRACE(kTraceLayerDrawBegin, back_buffer_->NumDirtyRects());
+    for (int i = 0; i < back_buffer_->NumDirtyRects(); ++i) {
+        Composite(back_buffer_->DirtyRect(i));
+    }
+    back_buffer_->Flush();
+    TRACE(kTraceLayerDrawEnd);
+}
+
+Layer* LayerManager::FindLayer(unsigned int id) {
+    if (id == 0 || id > static_cast<unsigned int>(num_layers_)) {
+        return nullptr;
+    }
+    return layers_[id - 1];
+}
+
+int LayerManager::HeightOf(const Layer* layer) const {
+    for (int h = 0; h < stack_height_; ++h) {
+        if (layer_stack_[h] == layer) {
+            return h;
+        }
+    }
+    return -1;
+}
+
+void LayerManager::MarkDirtyScreen(const Rectangle<int>& area) {
+    back_buffer_->MarkDirty(area);
+}
+
+void LayerManager::Composite(const Rectangle<int>& area) {
+    const auto& dst = back_buffer_->Config();
+    const Rectangle<int> screen{{0, 0},
+                                {static_cast<int>(dst.horizontal_resolution),
+                                 static_cast<int>(dst.vertical_resolution)}};
+    const auto target = area & screen;
+    if (IsEmpty(target)) {
+        return;
+    }
+
+    // 最前面のレイヤーから順に、まだ隠されていない部分だけを書き込む。
+    // 不透明なレイヤーが書き込んだ部分はそれより下のレイヤーからは書き込まない。
+    PieceList uncovered;
+    uncovered.Push(target);
+
+    // 透明色を持つレイヤーは下が確定してから書く必要があるので後回しにする
+    struct DeferredPiece {
+        const Layer* layer;
+        Rectangle<int> area;
+    };
+    std::array<DeferredPiece, kMaxPieces> deferred;
+    int num_deferred = 0;
+
+    for (int h = stack_height_ - 1; h >= 0 && uncovered.num_pieces > 0; --h) {
+        const Layer* layer = layer_stack_[h];
+        const auto layer_area = layer->Area();
+
+        if (layer->IsTransparent()) {
+            for (int i = 0; i < uncovered.num_pieces; ++i) {
+                const auto part = uncovered.pieces[i] & layer_area;
+                if (IsEmpty(part)) {
+                    continue;
+                }
+                if (num_deferred == kMaxPieces) {
+                    CompositeAll(target);
+                    return;
+                }
+                deferred[num_deferred++] = {layer, part};
+            }
+            continue;
+        }
+
+        PieceList next;
+        for (int i = 0; i < uncovered.num_pieces; ++i) {
+            const auto& piece = uncovered.pieces[i];
+            const auto part = piece & layer_area;
+            if (IsEmpty(part)) {
+                if (!next.Push(piece)) {
+                    CompositeAll(target);
+                    return;
+                }
+                continue;
+            }
+            layer->DrawTo(dst, part);
+            if (!Subtract(piece, part, next)) {
+                CompositeAll(target);
+                return;
+            }
+        }
+        uncovered = next;
+    }
+
+    for (int i = 0; i < uncovered.num_pieces; ++i) {
+        FillBlack(dst, uncovered.pieces[i]);
+    }
+    // 後回しにした透明レイヤーは下にあるものから順に書く
+    for (int i = num_deferred - 1; i >= 0; --i) {
+        deferred[i].layer->DrawTo(dst, deferred[i].area);
+    }
+}
+
+void LayerManager::CompositeAll(const Rectangle<int>& area) {
+    // 断片が多すぎて遮蔽判定ができないときは、背面から順にすべて書き込む
+    FillBlack(back_buffer_->Config(), area);
+    for (int h = 0; h < stack_height_; ++h) {
+        const auto part = area & layer_stack_[h]->Area();
+        if (!IsEmpty(part)) {
+            layer_stack_[h]->DrawTo(back_buffer_->Config(), part);
+        }
+    }
+}
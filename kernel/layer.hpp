@@ -0,0 +1,126 @@
+/**
+ * @file layer.hpp
+ *
+ * 重ね合わせ処理 (レイヤー) を提供する。
+ */
+
+#pragma once
+
+#include <array>
+
+#include "back_buffer.hpp"
+#include "error.hpp"
+#include "frame_buffer_config.hpp"
+#include "graphics.hpp"
+
+/** @brief 1 枚の描画面を表す.
+ *
+ * 描画面はメインメモリ上にあり、画面と同じピクセルフォーマットを持つ。
+ * Config() を FrameBufferWriter に渡せば、レイヤーの左上を原点として描画できる。
+ */
+class Layer {
+   public:
+    Layer(unsigned int id);
+    ~Layer();
+    Layer(const Layer&) = delete;
+    Layer& operator=(const Layer&) = delete;
+
+    unsigned int ID() const { return id_; }
+
+    /** @brief 大きさ width x height の描画面を確保する.
+     *
+     * @return 確保できなかった場合は Error::kNoEnoughMemory
+     */
+    Error Initialize(int width, int height, PixelFormat format);
+
+    /** @brief 描画先として使う描画面の設定 */
+    const FrameBufferConfig& Config() const { return config_; }
+
+    /** @brief 描画面のうち、ピクセル値が pixel の部分を透明として扱う.
+     *
+     * 透明色を持つレイヤーは下のレイヤーを隠さない (遮蔽判定に使われない)。
+     * pixel は PixelWriter::Pack で変換済みの値を渡す。
+     */
+    void SetTransparentPixel(uint32_t pixel);
+    bool IsTransparent() const { return transparent_; }
+
+    Vector2D<int> Position() const { return pos_; }
+    /** @brief 画面上でレイヤーが占める領域 */
+    Rectangle<int> Area() const {
+        return {pos_,
+                {static_cast<int>(config_.horizontal_resolution),
+                 static_cast<int>(config_.vertical_resolution)}};
+    }
+
+    /** @brief レイヤーの位置を画面上の絶対座標 pos に変更する. 再描画はしない */
+    void Move(Vector2D<int> pos) { pos_ = pos; }
+
+    /** @brief 画面座標で表した area の範囲を dst に書き込む.
+     *
+     * area はレイヤーの領域 Area() と dst の範囲に収まっていること。
+     * 透明色を持たなければ CopyRect で行単位に複写し、
+     * 持っていれば透明色を飛ばして書き込む。
+     */
+    void DrawTo(const FrameBufferConfig& dst, const Rectangle<int>& area) const;
+
+   private:
+    unsigned int id_;
+    Vector2D<int> pos_{0, 0};
+    FrameBufferConfig config_{};
+    bool transparent_{false};
+    uint32_t transparent_pixel_{0};
+};
+
+/** @brief 複数のレイヤーを重ね順 (z-order) に従って裏画面へ合成する.
+ *
+ * 変更された範囲は裏画面の変更領域 (BackBuffer::MarkDirty) として記録しておき、
+ * Draw でその範囲だけを合成し、画面へ転送する。
+ * 不透明なレイヤーに隠れている部分は合成しない。
+ */
+class LayerManager {
+   public:
+    static const int kMaxLayers = 16;
+
+    /** @brief 合成先の裏画面を設定する. 画面の大きさとフォーマットもここから決まる */
+    void SetBackBuffer(BackBuffer* back_buffer);
+
+    /** @brief 新しいレイヤーを作る. 作った直後は非表示.
+     *
+     * @return 描画面を確保できなかった場合は nullptr
+     */
+    Layer* NewLayer(int width, int height);
+
+    /** @brief レイヤーの重ね順を変更する.
+     *
+     * new_height が負ならレイヤーを非表示にする。
+     * 現在の最大の高さを超える値なら最前面に置く。
+     */
+    void UpDown(unsigned int id, int new_height);
+    /** @brief レイヤーを非表示にする */
+    void Hide(unsigned int id);
+
+    /** @brief レイヤーの位置を画面上の絶対座標 pos に変更する */
+    void Move(unsigned int id, Vector2D<int> pos);
+    /** @brief レイヤーの位置を displacement だけ相対移動する */
+    void MoveRelative(unsigned int id, Vector2D<int> displacement);
+
+    /** @brief レイヤー内の座標で表した area が書き換えられたことを記録する */
+    void MarkDirty(unsigned int id, const Rectangle<int>& area);
+
+    /** @brief 記録された範囲を合成し、画面へ転送する */
+    void Draw();
+
+   private:
+    BackBuffer* back_buffer_{nullptr};
+    std::array<Layer*, kMaxLayers> layers_{};
+    int num_layers_{0};
+    /** @brief 表示中のレイヤー. 先頭が最背面 */
+    std::array<Layer*, kMaxLayers> layer_stack_{};
+    int stack_height_{0};
+
+    Layer* FindLayer(unsigned int id);
+    int HeightOf(const Layer* layer) const;
+    void MarkDirtyScreen(const Rectangle<int>& area);
+    void Composite(const Rectangle<int>& area);
+    void CompositeAll(const Rectangle<int>& area);
+};
@@ -1,32 +1,205 @@
 #include "logger.hpp"
 
+#include <atomic>
 #include <cstdarg>
 #include <cstddef>
-#include <cstdio>
+#include <cstdint>
 
 #include "console.hpp"
+#include "format.hpp"
+#include "serial.hpp"
+
+LogLevel log_levels[kNumLogCategories] = {kWarn, kWarn, kWarn, kWarn, kWarn};
+static_assert(kNumLogCategories == 5);
 
 namespace {
-    LogLevel log_level = kWarn;
+    int log_sinks = kLogSinkConsole | kLogSinkSerial;
+
+    /** @brief 優先度ごとの文字の色 (SGR). 色を変えない優先度は nullptr */
+    const char* LevelColor(LogLevel level) {
+        switch (level) {
+            case kError:
+                return "\x1b[91m";
+            case kWarn:
+                return "\x1b[93m";
+            default:
+                return nullptr;
+        }
+    }
+
+    /** @brief 書式化済みのログを溜めておくリングバッファ.
+     *
+     * 割り込みハンドラを含む複数の書き手から、ロックを取らずに追記できる。
+     * 書き手は書き込む領域を CAS で予約してから本文を書き、
+     * 最後にレコードの ready を立てる。
+     * 読み手は DrainLog だけで、ready が立ったレコードを古い順に取り出す。
+     *
+     * 書き手は head_ を進めてからヘッダを書くので、その間に読み手が
+     * 見るヘッダの位置には前の周の本文が残っているかもしれない。
+     * そこで読み手は取り出したレコードの範囲をすべて 0 に戻してから
+     * tail_ を進め、まだ書かれていないヘッダの ready が必ず 0 になるようにする。
+     */
+    class LogRing {
+       public:
+        /** @brief バッファの大きさ. 2 のべき乗 */
+        static const size_t kSize = 64 * 1024;
+        /** @brief 1 レコードの本文の最大長 */
+        static const size_t kMaxMessage = 1024;
+
+        /** @brief レコードを追記する. 空きが無ければ捨てて数を数える */
+        bool Push(LogLevel level, const char* s, size_t len) {
+            len = len < kMaxMessage ? len : kMaxMessage;
+            const size_t record = RecordSize(len);
+
+            size_t head = head_.load(std::memory_order_relaxed);
+            do {
+                if (head + record - tail_.load(std::memory_order_acquire) >
+                    kSize) {
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            } while (!head_.compare_exchange_weak(head, head + record,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_relaxed));
+
+            for (size_t i = 0; i < len; ++i) {
+                buf_[(head + sizeof(Header) + i) % kSize] = s[i];
+            }
+            Header* header = HeaderAt(head);
+            header->length = len;
+            header->level = level;
+            header->ready.store(1, std::memory_order_release);
+            return true;
+        }
+
+        /** @brief 最も古いレコードを取り出す.
+         *
+         * @param s kMaxMessage バイト以上の領域
+         * @return レコードが無いか、まだ書き込み中なら false
+         */
+        bool Pop(LogLevel& level, char* s, size_t& len) {
+            const size_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == head_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            Header* header = HeaderAt(tail);
+            if (!header->ready.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            len = header->length;
+            if (len > kMaxMessage) {
+                // 上の約束が守られていれば起きない. 壊れたレコードは読まない
+                return false;
+            }
+            level = static_cast<LogLevel>(header->level);
+            for (size_t i = 0; i < len; ++i) {
+                s[i] = buf_[(tail + sizeof(Header) + i) % kSize];
+            }
+
+            // ヘッダを含めて 0 に戻す. tail_ を進めるまでは書き手が来ない
+            const size_t record = RecordSize(len);
+            for (size_t i = 0; i < record; ++i) {
+                buf_[(tail + i) % kSize] = 0;
+            }
+            tail_.store(tail + record, std::memory_order_release);
+            return true;
+        }
+
+        /** @brief 前回の呼び出し以降に捨てたレコードの数 */
+        uint32_t TakeDropped() {
+            return dropped_.exchange(0, std::memory_order_relaxed);
+        }
+
+       private:
+        struct Header {
+            uint16_t length;
+            uint8_t level;
+            std::atomic<uint8_t> ready;
+        };
+        static_assert(sizeof(Header) == 4);
+
+        // レコードは 4 バイト境界に置くので、ヘッダがバッファの端で分かれることはない
+        static size_t RecordSize(size_t len) {
+            return sizeof(Header) + ((len + 3) & ~static_cast<size_t>(3));
+        }
+        Header* HeaderAt(size_t pos) {
+            return reinterpret_cast<Header*>(&buf_[pos % kSize]);
+        }
+
+        alignas(4) char buf_[kSize];
+        // 書き込み位置と読み出し位置. 単調に増え、kSize で割った余りで使う
+        std::atomic<size_t> head_{0}, tail_{0};
+        std::atomic<uint32_t> dropped_{0};
+    };
+
+    LogRing log_ring;
 }
 
 extern Console* console;
+extern SerialPort* serial_port;
 
-void SetLogLevel(LogLevel level) { log_level = level; }
+namespace {
+    void WriteSinks(const char* s) {
+        if ((log_sinks & kLogSinkConsole) && console) {
+            console->PutString(s);
+        }
+        if ((log_sinks & kLogSinkSerial) && serial_port) {
+            serial_port->Write(s);
+        }
+    }
+}  // namespace
 
-int Log(LogLevel level, const char* format, ...) {
-    if (level > log_level) {
-        return 0;
+void SetLogSinks(int sinks) { log_sinks = sinks; }
+
+void SetLogLevel(LogLevel level) {
+    for (auto& l : log_levels) {
+        l = level;
     }
+}
+
+void SetLogLevel(LogCategory category, LogLevel level) {
+    log_levels[category] = level;
+}
 
+int Log(LogLevel level, const char* format, ...) {
     va_list ap;
     int result;
-    char s[1024];
+    char s[LogRing::kMaxMessage];
 
     va_start(ap, format);
-    result = vsprintf(s, format, ap);
+    result = VFormatString(s, sizeof(s), format, ap);
     va_end(ap);
 
-    console->PutString(s);
+    // 描画は DrainLog に任せ、ここではリングバッファに積むだけにする.
+    // 長すぎるログは s に収まるように切り詰められている
+    if (result > 0) {
+        log_ring.Push(level, s, result);
+    }
     return result;
-}
\ No newline at end of file
+}
+
+void DrainLog() {
+    LogLevel level;
+    char s[LogRing::kMaxMessage + 1];
+    size_t len;
+    while (log_ring.Pop(level, s, len)) {
+        s[len] = '\0';
+        // エラーと警告は目立つように色を付ける
+        const char* color = LevelColor(level);
+        if (color) {
+            WriteSinks(color);
+        }
+        WriteSinks(s);
+        if (color) {
+            WriteSinks("\x1b[0m");
+        }
+    }
+
+    if (auto dropped = log_ring.TakeDropped()) {
+        char message[64];
+        FormatString(message, sizeof(message),
+                 "\x1b[93m[log] %u messages dropped\x1b[0m\n", dropped);
+        WriteSinks(message);
+    }
+}
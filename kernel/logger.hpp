@@ -2,20 +2,89 @@
 
 enum LogLevel { kError = 3, kWarn = 4, kInfo = 6, kDebug = 7 };
 
-/** @brief グローバルなログ優先度の閾値を変更する.
+/** @brief ログの発生元. 発生元ごとに優先度の閾値を設定できる */
+enum LogCategory {
+    kLogGeneral,
+    kLogPCI,
+    kLogXHCI,  // xHC と USB デバイスの列挙
+    kLogHID,
+    kLogGraphics,
+    kNumLogCategories,
+};
+
+/** @brief ビルド時に残すログの優先度の上限.
+ *
+ * これより優先度の低い (値の大きい) LOG はコンパイル時に取り除かれ、
+ * 引数の評価も書式文字列もカーネルに残らない。
+ * make LOG_LEVEL_MAX=6 のように指定する。
+ */
+#ifndef LOG_LEVEL_MAX
+#define LOG_LEVEL_MAX 7
+#endif
+constexpr LogLevel kLogLevelMax = static_cast<LogLevel>(LOG_LEVEL_MAX);
+
+/** @brief 発生元ごとの優先度の閾値. LogEnabled から参照するためだけに公開する */
+extern LogLevel log_levels[kNumLogCategories];
+
+/** @brief category の level のログが現在記録される設定なら true */
+inline bool LogEnabled(LogCategory category, LogLevel level) {
+    return level <= log_levels[category];
+}
+
+/** @brief 発生元 category のログを優先度 level で記録する.
+ *
+ * level がビルド時の上限 kLogLevelMax を超えていれば何も生成しない。
+ * 実行時の閾値で捨てられる場合も、書式化はおろか引数の評価もしない。
+ * level は定数式であること。
+ */
+#define LOG(category, level, ...)                      \
+    do {                                               \
+        if constexpr ((level) <= kLogLevelMax) {       \
+            if (LogEnabled((category), (level))) {     \
+                Log((level), __VA_ARGS__);             \
+            }                                          \
+        }                                              \
+    } while (0)
+
+/** @brief すべての発生元のログ優先度の閾値を変更する.
  *
  * グローバルなログ優先度の閾値を level にせっていする。
- * 以降の Log の呼び出しでは、ここで設定した優先度以上のログのみ記録される。
+ * 以降の LOG の呼び出しでは、ここで設定した優先度以上のログのみ記録される。
  * 例えば、kInfoでログを書くと、kInfo, kDebugの時のみに表示される。
  */
 void SetLogLevel(LogLevel level);
 
+/** @brief 発生元 category のログ優先度の閾値だけを変更する */
+void SetLogLevel(LogCategory category, LogLevel level);
+
 /** @brief ログを指定された優先度で記録する。
  *
- * 指定された優先度が閾値以上ならば記録する。
- * 優先度が閾値未満ならログは捨てられる。
+ * 閾値の判定はしないので、通常は LOG マクロを通して呼ぶ。
+ * 記録したログはリングバッファに積まれ、DrainLog で出力される。
+ * ロックを取らないので、割り込みハンドラからも呼べる。
  *
- * @param level ログの優先度. 閾値以上の優先度のログのみが記録される。
+ * @param level ログの優先度. 出力時の色分けに使う
  * @param format 書式文字列. printk と互換
  */
-int Log(LogLevel level, const char* format, ...);
\ No newline at end of file
+int Log(LogLevel level, const char* format, ...);
+
+/** @brief ログの出力先. 組み合わせて SetLogSinks に渡す */
+enum LogSink {
+    kLogSinkConsole = 1 << 0,
+    kLogSinkSerial = 1 << 1,  // COM1. 画面から流れたログも残せる
+};
+
+/** @brief ログの出力先を sinks (LogSink の論理和) に変更する.
+ *
+ * 初期値はコンソールとシリアルポートの両方。
+ * 出力先の装置が用意されていなければ、その出力先は無視される。
+ */
+void SetLogSinks(int sinks);
+
+/** @brief Log で溜めたログを出力先へ書き出す.
+ *
+ * Log はログをリングバッファに積むだけで、出力先への書き出しはここで行う。
+ * メインループの空き時間に呼ぶ。
+ * リングバッファが一杯で捨てたログがあれば、その数も書き出す。
+ */
+void DrainLog();
@@ -1,17 +1,31 @@
+#include <array>
 #include <cstdarg>
 #include <cstddef>
 #include <cstdint>
-#include <cstdio>
 #include <numeric>
 #include <vector>
 
+#include "back_buffer.hpp"
+#include "clock.hpp"
 #include "console.hpp"
 #include "font.hpp"
+#include "format.hpp"
 #include "frame_buffer_config.hpp"
 #include "graphics.hpp"
+#include "heap.hpp"
+#include "interrupt.hpp"
+#include "layer.hpp"
 #include "logger.hpp"
+#include "memory_map.hpp"
+#include "message.hpp"
 #include "mouse.hpp"
 #include "pci.hpp"
+#include "serial.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+#include "timer_wheel.hpp"
+#include "trace.hpp"
+#include "usb/classdriver/keyboard.hpp"
 #include "usb/classdriver/mouse.hpp"
 #include "usb/device.hpp"
 #include "usb/memory.hpp"
@@ -28,21 +42,58 @@ const PixelColor kDesktopFGColor{255, 255, 255};
 char console_buf[sizeof(Console)];
 Console* console;
 char pixel_writer_buf[sizeof(RGBResv8BitPerColorPixelWriter)];
+static_assert(sizeof(RGBResv8BitPerColorPixelWriter) ==
+              sizeof(BGRResv8BitPerColorPixelWriter));
 PixelWriter* pixel_writer;
 
+char back_buffer_buf[sizeof(BackBuffer)];
+BackBuffer* back_buffer;
+
+char layer_manager_buf[sizeof(LayerManager)];
+LayerManager* layer_manager;
+
+char serial_port_buf[sizeof(SerialPort)];
+SerialPort* serial_port;
+
+// USB のイベント処理から描画などを切り離すために、メインのタスクへ送るキュー
+MessageQueue main_queue;
+
+char timer_wheel_buf[sizeof(TimerWheel)];
+TimerWheel* timer_wheel;
+
+// TaskContext の FXSAVE 領域は 16 バイト境界に置く必要がある
+alignas(TaskManager) char task_manager_buf[sizeof(TaskManager)];
+TaskManager* task_manager;
+
+// メッセージの処理や描画を行うタスク (KernelMain) と、xHC のイベントを処理するタスク.
+// USB の処理が描画に待たされないように、USB のタスクの優先度を高くする
+const int kMainTaskLevel = 1;
+const int kUSBTaskLevel = 2;
+Task* main_task;
+Task* usb_task;
+
+namespace {
+    /** @brief 書式化した文字列をそのままコンソールへ書く */
+    class ConsoleSink : public FormatSink {
+       public:
+        void Write(const char* s, size_t len) override {
+            console->PutString(s, len);
+        }
+    };
+}  // namespace
+
 int printk(const char* format, ...) {
     // 可変超引数を取る
     va_list ap;
     int result;
-    char s[1024];
+    ConsoleSink sink;
 
     va_start(ap, format);
-    // sprintfの親戚で、可変超引数の代わりにva_list型の変数を受け取ることができる。
-    // printkの内部で1024バイトの固定配列をとっているため、最大文字数に制限がありますが、それ以外はprintfと同様
-    result = vsprintf(s, format, ap);
+    // 中間のバッファを介さずにコンソールへ書く。
+    // 1 回の呼び出しで書けるのは 1024 バイトまでで、それ以降は捨てる
+    result = VFormat(sink, 1024, format, ap);
     va_end(ap);
 
-    console->PutString(s);
     return result;
 }
 
@@ -64,19 +115,94 @@ void SwitchEhci2Xhci(const pci::Device& xhc_dev) {
     pci::WriteConfReg(xhc_dev, 0xd8, superspeed_ports);           // USB3_PSSEN
     uint32_t ehci2xhci_ports = pci::ReadConfReg(xhc_dev, 0xd4);   // XUSB2PRM
     pci::WriteConfReg(xhc_dev, 0xd0, ehci2xhci_ports);            // XUSB2PR
-    Log(kDebug, "SwitchEhci2Xhci: SS = %02, xHCI = %02x\n", superspeed_ports,
-        ehci2xhci_ports);
+    LOG(kLogXHCI, kDebug, "SwitchEhci2Xhci: SS = %02, xHCI = %02x\n",
+        superspeed_ports, ehci2xhci_ports);
 }
 // #@@range_end(switch_echi2xhci)
 
 char mouse_cursor_buf[sizeof(MouseCursor)];
 MouseCursor* mouse_cursor;
 
+// オブザーバは USB のタスクの中から呼ばれるので、
+// 描画はせずにメッセージを積んでメインのタスクを起こすだけにする。満杯なら捨てる
 void MouseObserver(int8_t displacement_x, int8_t displacement_y) {
-    mouse_cursor->MoveRelative({displacement_x, displacement_y});
+    Message msg{Message::kMouseMove};
+    msg.arg.mouse_move.displacement_x = displacement_x;
+    msg.arg.mouse_move.displacement_y = displacement_y;
+    main_queue.Push(msg);
+    task_manager->Wakeup(*main_task);
 }
 
-extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config) {
+// キーボードの PageUp / PageDown キーの HID Usage ID
+const uint8_t kKeyPageUp = 0x4b;
+const uint8_t kKeyPageDown = 0x4e;
+
+void KeyboardObserver(uint8_t keycode) {
+    Message msg{Message::kKeyPush};
+    msg.arg.keyboard.keycode = keycode;
+    main_queue.Push(msg);
+    task_manager->Wakeup(*main_task);
+}
+
+/** @brief キューに溜まったメッセージをまとめて処理する.
+ *
+ * マウスの移動は足し合わせて、カーソルの再描画を 1 回で済ませる。
+ */
+void HandleMessages() {
+    std::array<Message, 32> messages;
+    Vector2D<int> mouse_move{0, 0};
+    bool mouse_moved = false;
+
+    while (size_t n = main_queue.PopBatch(messages.data(), messages.size())) {
+        for (size_t i = 0; i < n; ++i) {
+            const Message& msg = messages[i];
+            switch (msg.type) {
+                case Message::kMouseMove:
+                    mouse_move += Vector2D<int>{
+                        msg.arg.mouse_move.displacement_x,
+                        msg.arg.mouse_move.displacement_y};
+                    mouse_moved = true;
+                    break;
+                case Message::kKeyPush:
+                    // PageUp / PageDown でコンソールの表示をさかのぼる
+                    if (msg.arg.keyboard.keycode == kKeyPageUp) {
+                        console->PageUp();
+                    } else if (msg.arg.keyboard.keycode == kKeyPageDown) {
+                        console->PageDown();
+                    }
+                    break;
+            }
+        }
+    }
+
+    if (mouse_moved) {
+        mouse_cursor->MoveRelative(mouse_move);
+    }
+}
+
+template <class Writer>
+void DrawDesktop(Writer& writer, const FrameBufferConfig& frame_buffer_config) {
+    const int kFrameWidth = frame_buffer_config.horizontal_resolution;
+    const int kFrameHeight = frame_buffer_config.vertical_resolution;
+
+    // デスクトップ本体内部を塗りつぶす
+    FillRectangle(writer, {0, 0}, {kFrameWidth, kFrameHeight - 50},
+                  kDesktopBGColor);
+    FillRectangle(writer, {0, kFrameHeight - 50}, {kFrameWidth, 50},
+                  {1, 8, 17});
+    FillRectangle(writer, {0, kFrameHeight - 50}, {kFrameWidth / 5, 50},
+                  {80, 80, 80});
+    DrawRectangle(writer, {10, kFrameHeight - 40}, {30, 30},
+                  {160, 160, 160});
+}
+
+/** @brief ピクセルフォーマット kFormat 向けに描画まわりを初期化する。
+ *
+ * デスクトップ、コンソール、マウスカーソルはすべて
+ * FrameBufferWriter<kFormat> の具象型を通して各自のレイヤーに描画される。
+ */
+template <PixelFormat kFormat>
+void InitializeGraphics(const FrameBufferConfig& frame_buffer_config) {
     // 一般的なnew演算子は、new <クラス名> なので、引数を取らない
     // 一般のnewは指定したクラスのインスタンスをヒープ領域(関数の実行が終了しても破棄されない。)に生成する。
     // mallocとnewの違いは、クラスのコンストラクタが呼び出されるかどうか。
@@ -85,57 +211,217 @@ extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config) {
     // 配置newでは、メモリ領域の確保を行わない。
     // 配置newを使うには、<new>を淫クルーづするか自分で定義する必要がある。
     // C++では、operatorキーワードを使うことで演算子を定義できる。
+    // 描画はすべてメインメモリ上の裏画面に対して行い、変更部分だけを画面へ転送する。
+    // 裏画面を確保できなければ Config() は画面そのものを指す。
+    back_buffer = new (back_buffer_buf) BackBuffer;
+    back_buffer->Initialize(frame_buffer_config);
+
+    layer_manager = new (layer_manager_buf) LayerManager;
+    layer_manager->SetBackBuffer(back_buffer);
+
+    // デスクトップ、コンソール、マウスカーソルはそれぞれ別のレイヤーに描き、
+    // 裏画面へは合成した結果だけを書き込む。
+    const int kFrameWidth = frame_buffer_config.horizontal_resolution;
+    const int kFrameHeight = frame_buffer_config.vertical_resolution;
+    auto desktop_layer = layer_manager->NewLayer(kFrameWidth, kFrameHeight);
+    // コンソールは下端のタスクバーを除いた画面全体に広げる
+    auto console_layer =
+        layer_manager->NewLayer(kFrameWidth, kFrameHeight - 50);
+    auto mouse_layer =
+        layer_manager->NewLayer(kMouseCursorWidth, kMouseCursorHeight);
+    if (!desktop_layer || !console_layer || !mouse_layer) {
+        // レイヤーの描画面を確保できなければ何も表示できない
+        while (1) __asm__("hlt");
+    }
+
+    auto desktop_writer = new (pixel_writer_buf)
+        FrameBufferWriter<kFormat>{desktop_layer->Config()};
+    pixel_writer = desktop_writer;
+    DrawDesktop(*desktop_writer, frame_buffer_config);
+
+    auto console_writer =
+        new FrameBufferWriter<kFormat>{console_layer->Config()};
+    FillRectangle(*console_writer, {0, 0}, {kFrameWidth, kFrameHeight - 50},
+                  kDesktopBGColor);
+    // 高解像度の画面では文字を整数倍に拡大して表示する
+    console = new (console_buf)
+        Console{*console_writer, kDesktopFGColor, kDesktopBGColor,
+                ChooseFontScale(frame_buffer_config)};
+    if (console->Initialize()) {
+        while (1) __asm__("hlt");
+    }
+    console->SetLayer(layer_manager, console_layer->ID());
+
+    auto mouse_writer = new FrameBufferWriter<kFormat>{mouse_layer->Config()};
+    mouse_layer->SetTransparentPixel(
+        mouse_writer->Pack(kMouseTransparentColor));
+    mouse_cursor = new (mouse_cursor_buf)
+        MouseCursor{mouse_writer, layer_manager, mouse_layer->ID(),
+                    desktop_writer->Bounds(), {300, 200}};
+
+    layer_manager->UpDown(desktop_layer->ID(), 0);
+    layer_manager->UpDown(console_layer->ID(), 1);
+    layer_manager->UpDown(mouse_layer->ID(), 2);
+    layer_manager->Draw();
+}
+
+__attribute__((interrupt)) void IntHandlerXHCI(InterruptFrame* frame) {
+    // イベントの処理は USB のタスクで行うので、ここではタスクを起こすだけ
+    NotifyEndOfInterrupt();
+    if (usb_task) {
+        task_manager->Wakeup(*usb_task);
+        task_manager->Preempt();
+    }
+}
+
+__attribute__((interrupt)) void IntHandlerLAPICTimer(InterruptFrame* frame) {
+    LAPICTimerOnInterrupt();
+    NotifyEndOfInterrupt();
+    task_manager->RotateOnTick();
+}
+
+// 期限の来たタイマは、割り込みの中でまとめて期限切れにする
+void AdvanceTimerWheel(uint64_t tick) { timer_wheel->Advance(tick); }
+
+// ティックごとにメインのタスクを起こして、タイマの期限切れやログを処理させる
+void WakeupMainTask(uint64_t tick) { task_manager->Wakeup(*main_task); }
+
+// xHC の MSI が使えないときに、ティックごとにイベントを見に行かせる
+void WakeupUSBTask(uint64_t tick) { task_manager->Wakeup(*usb_task); }
+
+// コンソールのカーソルを点滅させる. 期限が来るたびに登録し直す
+const uint64_t kCursorBlinkMs = 500;
+void BlinkCursor(Timer& timer, void* arg) {
+    console->ToggleCursor();
+    timer_wheel->AddAfter(timer, kCursorBlinkMs);
+}
+
+/** @brief xHC のイベントを処理するタスク.
+ *
+ * data は usb::xhci::Controller へのポインタ。イベントが無ければ眠り、
+ * xHC の割り込み (MSI が使えなければティック) で起こされる。
+ */
+void TaskUSB(uint64_t task_id, int64_t data) {
+    auto& xhc = *reinterpret_cast<usb::xhci::Controller*>(data);
+    while (1) {
+        // 確認してから眠るまでの間に来た割り込みを取りこぼさないように、
+        // 割り込みを禁止して確認する
+        __asm__("cli");
+        if (!xhc.PrimaryEventRing()->HasFront()) {
+            task_manager->Sleep();
+        }
+        __asm__("sti");
+
+        while (xhc.PrimaryEventRing()->HasFront()) {
+            if (auto err = ProcessEvent(xhc)) {
+                LOG(kLogXHCI, kError, "Error while ProcessEvent: %s at %s:%d\n",
+                    err.Name(), err.File(), err.Line());
+            }
+        }
+    }
+}
+
+__attribute__((interrupt)) void IntHandlerSerial(InterruptFrame* frame) {
+    serial_port->OnInterrupt();
+    NotifyEndOfInterrupt();
+}
+
+extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config,
+                           const MemoryMap& memory_map) {
+    // 裏画面やレイヤーの確保に使うヒープを用意する
+    if (auto err = InitializeHeap(memory_map)) {
+        while (1) __asm__("hlt");
+    }
+    InitializeTrace();
+    // 以降の処理時間の計測やトレースの時刻は TSC を基準にする
+    const Error clock_err = InitializeClock();
+    SetTraceTSCFrequency(TSCFrequency());
+    // KernelMain 自身をメインのタスクとして、タスクの切り替えを始める.
+    // タイマ割り込みのハンドラが使うので、割り込みを許可する前に作る
+    task_manager = new (task_manager_buf) TaskManager{kMainTaskLevel};
+    main_task = &task_manager->CurrentTask();
+
+    const uint16_t cs = GetCS();
+    SetIDTEntry(idt[InterruptVector::kXHCI],
+                MakeIDTAttr(DescriptorType::kInterruptGate, 0),
+                reinterpret_cast<uint64_t>(IntHandlerXHCI), cs);
+    SetIDTEntry(idt[InterruptVector::kSerial],
+                MakeIDTAttr(DescriptorType::kInterruptGate, 0),
+                reinterpret_cast<uint64_t>(IntHandlerSerial), cs);
+    SetIDTEntry(idt[InterruptVector::kLAPICTimer],
+                MakeIDTAttr(DescriptorType::kInterruptGate, 0),
+                reinterpret_cast<uint64_t>(IntHandlerLAPICTimer), cs);
+    InitializeInterrupt();
+    __asm__("sti");
+
+    // デバイスを待つときのタイムアウトにはティックを使う
+    const Error timer_err = InitializeLAPICTimer();
+    if (!timer_err) {
+        StartLAPICTimerPeriodic();
+    }
+    // タイムアウトはタイマ割り込みで進めるホイールで管理し、
+    // 期限が来た関数はメインのタスクで呼ぶ
+    timer_wheel = new (timer_wheel_buf) TimerWheel{CurrentTick(), *main_task};
+    AddTimerCallback(AdvanceTimerWheel);
+
+    // ログの出力先の 1 つ. UART が無ければ使わない
+    serial_port = new (serial_port_buf) SerialPort{kCOM1};
+    if (serial_port->Initialize()) {
+        serial_port = nullptr;
+    } else {
+        // COM1 は ISA の IRQ 4
+        RouteISAInterrupt(4, InterruptVector::kSerial);
+        serial_port->EnableInterrupt(true);
+    }
+
+    // ピクセルフォーマットの判定はここで一度だけ行い、
+    // 以降の描画処理はフォーマットごとに実体化されたものを使う。
     switch (frame_buffer_config.pixel_format) {
         case kPixelRGBResv8BitPerColor:
-            pixel_writer = new (pixel_writer_buf)
-                RGBResv8BitPerColorPixelWriter{frame_buffer_config};
+            InitializeGraphics<kPixelRGBResv8BitPerColor>(frame_buffer_config);
             break;
         case kPixelBGRResv8BitPerColor:
-            pixel_writer = new (pixel_writer_buf)
-                BGRResv8BitPerColorPixelWriter{frame_buffer_config};
+            InitializeGraphics<kPixelBGRResv8BitPerColor>(frame_buffer_config);
             break;
     }
 
-    const int kFrameWidth = frame_buffer_config.horizontal_resolution;
-    const int kFrameHeight = frame_buffer_config.vertical_resolution;
-
-    // デスクトップ本体内部を塗りつぶす
-    FillRectangle(*pixel_writer, {0, 0}, {kFrameWidth, kFrameHeight - 50},
-                  kDesktopBGColor);
-    FillRectangle(*pixel_writer, {0, kFrameHeight - 50}, {kFrameWidth, 50},
-                  {1, 8, 17});
-    FillRectangle(*pixel_writer, {0, kFrameHeight - 50}, {kFrameWidth / 5, 50},
-                  {80, 80, 80});
-    DrawRectangle(*pixel_writer, {10, kFrameHeight - 40}, {30, 30},
-                  {160, 160, 160});
-
-    console = new (console_buf)
-        Console{*pixel_writer, kDesktopFGColor, kDesktopBGColor};
     printk("Welcome to MikanOS!\n");
+    console->Render();
     SetLogLevel(kInfo);
-
-    mouse_cursor = new (mouse_cursor_buf)
-        MouseCursor{pixel_writer, kDesktopBGColor, {300, 200}};
+    // ホストからメモリダンプで取り出せるように、トレースバッファの位置を出す
+    LOG(kLogGeneral, kInfo, "trace buffer: %p, %lu bytes\n", &trace_buffer,
+        sizeof(trace_buffer));
+    if (clock_err) {
+        LOG(kLogGeneral, kWarn, "TSC calibration failed: %s\n",
+            clock_err.Name());
+    } else {
+        LOG(kLogGeneral, kInfo, "TSC: %lu kHz\n", TSCFrequency() / 1000);
+    }
+    if (timer_err) {
+        LOG(kLogGeneral, kWarn, "Local APIC timer is not available: %s\n",
+            timer_err.Name());
+    }
 
     // PCIデバイスを操作する。
     auto err = pci::ScanAllBus();
-    Log(kDebug, "ScanAllBus: %s\n", err.Name());
+    LOG(kLogPCI, kDebug, "ScanAllBus: %s\n", err.Name());
 
     for (int i = 0; i < pci::num_device; i++) {
         const auto& dev = pci::devices[i];
         auto vendor_id = pci::ReadVendorId(dev.bus, dev.device, dev.function);
         auto class_code = pci::ReadClassCode(dev.bus, dev.device, dev.function);
-        Log(kDebug, "%d.%d.%d: vend %04x, class %08x, head %02x\n", dev.bus,
-            dev.device, dev.function, vendor_id, class_code, dev.header_type);
+        LOG(kLogPCI, kDebug, "%d.%d.%d: vend %04x, class %08x, head %02x\n",
+            dev.bus, dev.device, dev.function, vendor_id, class_code,
+            dev.header_type);
     }
 
     // Intel 製を優先してxHCを探す。
     pci::Device* xhc_dev = nullptr;
     for (int i = 0; i < pci::num_device; i++) {
-        Log(kInfo, "%d\n", i);
+        LOG(kLogPCI, kInfo, "%d\n", i);
         if (pci::devices[i].class_code.Match(0x0cu, 0x03u, 0x30u)) {
             xhc_dev = &pci::devices[i];
-            Log(kInfo, "xHC Found: %d\n", i);
+            LOG(kLogPCI, kInfo, "xHC Found: %d\n", i);
             if (0x8086 == pci::ReadVendorId(*xhc_dev)) {
                 break;
             }
@@ -143,59 +429,123 @@ extern "C" void KernelMain(const FrameBufferConfig& frame_buffer_config) {
     }
 
     if (xhc_dev) {
-        Log(kInfo, "xHC has been found: %d.%d.%d\n", xhc_dev->bus,
+        LOG(kLogPCI, kInfo, "xHC has been found: %d.%d.%d\n", xhc_dev->bus,
             xhc_dev->device, xhc_dev->function);
     } else {
         // デバイスが見つからなかったとき
-        Log(kError, "Error xHC not found: %08lx\n", xhc_dev);
+        LOG(kLogPCI, kError, "Error xHC not found: %08lx\n", xhc_dev);
+        DrainLog();
+        console->Render();
+        if (serial_port) {
+            serial_port->Flush();
+        }
         while (1) __asm__("hlt");
     }
 
     // BARを読む。(MMIO上でのアドレス位置を特定する。)
     const WithError<uint64_t> xhc_bar = pci::ReadBar(*xhc_dev, 0);
-    Log(kInfo, "ReadBar: %s\n", xhc_bar.error.Name());
+    LOG(kLogPCI, kInfo, "ReadBar: %s\n", xhc_bar.error.Name());
     const uint64_t xhc_mmio_base = xhc_bar.value & ~static_cast<uint64_t>(0xf);
-    Log(kInfo, "xHC mmio_base = %08lx\n", xhc_mmio_base);
+    LOG(kLogXHCI, kInfo, "xHC mmio_base = %08lx\n", xhc_mmio_base);
 
     // xhcを初期化する。
     usb::xhci::Controller xhc{xhc_mmio_base};
     if (0x8086 == pci::ReadVendorId(*xhc_dev)) {
         SwitchEhci2Xhci(*xhc_dev);
     }
-    Log(kInfo, "xHX initialize start.");
+
+    // xHC のイベントは MSI で通知させる. 使えなければポーリングで待つ
+    const Error msi_err = pci::ConfigureMSIFixedDestination(
+        *xhc_dev, LocalAPICID(), pci::MSITriggerMode::kLevel,
+        pci::MSIDeliveryMode::kFixed, InterruptVector::kXHCI, 0);
+    if (msi_err) {
+        LOG(kLogPCI, kWarn, "xHC MSI is not available: %s\n", msi_err.Name());
+    }
+    LOG(kLogXHCI, kInfo, "xHX initialize start.");
 
     {
-        auto err = xhc.Initialize();
-        Log(kInfo, "xhc.Initialize: %s\n", err.Name());
+        CycleStats init_stats;
+        Error err = MAKE_ERROR(Error::kSuccess);
+        {
+            ScopedCycleTimer timer{init_stats};
+            err = xhc.Initialize();
+        }
+        LOG(kLogXHCI, kInfo, "xhc.Initialize: %s (%lu us)\n", err.Name(),
+            init_stats.AverageNanoseconds() / 1000);
+    }
+    LOG(kLogXHCI, kInfo, "xHC starting\n");
+    if (auto err = xhc.Run()) {
+        LOG(kLogXHCI, kError, "xhc.Run: %s\n", err.Name());
     }
-    Log(kInfo, "xHC starting\n");
-    xhc.Run();
 
     // ポートコンフィグ
     usb::HIDMouseDriver::default_observer = MouseObserver;
+    usb::HIDKeyboardDriver::default_observer = KeyboardObserver;
 
     // すべてのUSBポートを探索して、何かが接続されているポートの設定を行う
+    CycleStats port_stats;
     for (int i = 1; i <= xhc.MaxPorts(); i++) {
         auto port = xhc.PortAt(i);
-        Log(kInfo, "Port %d: IsConnected=%d\n", i, port.IsConnected());
+        LOG(kLogXHCI, kInfo, "Port %d: IsConnected=%d\n", i,
+            port.IsConnected());
 
         if (port.IsConnected()) {
             // ConfigurePortは、ポートのリセットやxHC内部設定、クラスドライバの生成などを行う
             // あるポートにUSBマウスが接続されていた場合、USB::HIDMouseDrive::default_observerに設定した関数が
             // そのUSBマウスからのデータを受信する関数として、USBマウス用のクラスドライバに登録される。
+            ScopedCycleTimer timer{port_stats};
             if (auto err = ConfigurePort(xhc, port)) {
-                Log(kError, "failed to configure port: %s at %s:%d\n",
+                LOG(kLogXHCI, kError, "failed to configure port: %s at %s:%d\n",
                     err.Name(), err.File(), err.Line());
                 continue;
             }
         }
     }
+    LOG(kLogXHCI, kInfo, "ConfigurePort: %lu ports, avg %lu us, max %lu us\n",
+        port_stats.count, port_stats.AverageNanoseconds() / 1000,
+        CyclesToNanoseconds(port_stats.max) / 1000);
+
+    // ここからは xHC のイベントを USB のタスクで処理する
+    auto [task, task_err] = task_manager->NewTask(
+        TaskUSB, reinterpret_cast<int64_t>(&xhc), kUSBTaskLevel);
+    if (task_err) {
+        LOG(kLogGeneral, kError, "failed to create USB task: %s\n",
+            task_err.Name());
+        DrainLog();
+        console->Render();
+        while (1) __asm__("hlt");
+    }
+    usb_task = task;
+    AddTimerCallback(WakeupMainTask);
+    if (msi_err) {
+        AddTimerCallback(WakeupUSBTask);
+    }
+    task_manager->Wakeup(*usb_task);
+
+    // KernelMain は戻らないので、タイマはこのスタックに置いておける
+    Timer cursor_timer{BlinkCursor, nullptr};
+    timer_wheel->AddAfter(cursor_timer, kCursorBlinkMs);
 
     while (1) {
-        if (auto err = ProcessEvent(xhc)) {
-            Log(kError, "Error while ProcessEvent: %s at %s:%d\n", err.Name(),
-                err.File(), err.Line());
+        // タイマ割り込みの中で期限切れになったタイマの関数を呼ぶ
+        timer_wheel->RunExpired();
+        HandleMessages();
+
+        // 溜まったログとコンソール出力をまとめて描画する.
+        // 時間がかかっても、USB のイベントは優先度の高いタスクで処理される
+        DrainLog();
+        console->Render();
+        if (serial_port) {
+            serial_port->Poll();
+        }
+
+        // 次のメッセージかティックまで眠る. 確認してから眠るまでの間に
+        // 積まれたメッセージを取りこぼさないように、割り込みを禁止して確認する
+        __asm__("cli");
+        if (main_queue.Empty() && !timer_wheel->HasExpired()) {
+            task_manager->Sleep();
         }
+        __asm__("sti");
     }
 
     while (1) __asm__("hlt");
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stdint.h>
+
+/* ローダとカーネルで共有する、UEFI のメモリマップを表す構造体。
+ * MikanLoaderPkg/memory_map.hpp と同じ内容にしておくこと。
+ */
+struct MemoryMap {
+    unsigned long long buffer_size;
+    void* buffer;
+    unsigned long long map_size;
+    unsigned long long map_key;
+    unsigned long long descriptor_size;
+    uint32_t descriptor_version;
+};
+
+/* EFI_MEMORY_DESCRIPTOR と同じレイアウト */
+struct MemoryDescriptor {
+    uint32_t type;
+    uintptr_t physical_start;
+    uintptr_t virtual_start;
+    uint64_t number_of_pages;
+    uint64_t attribute;
+};
+
+#ifdef __cplusplus
+enum class MemoryType {
+    kEfiReservedMemoryType,
+    kEfiLoaderCode,
+    kEfiLoaderData,
+    kEfiBootServicesCode,
+    kEfiBootServicesData,
+    kEfiRuntimeServicesCode,
+    kEfiRuntimeServicesData,
+    kEfiConventionalMemory,
+    kEfiUnusableMemory,
+    kEfiACPIReclaimMemory,
+    kEfiACPIMemoryNVS,
+    kEfiMemoryMappedIO,
+    kEfiMemoryMappedIOPortSpace,
+    kEfiPalCode,
+    kEfiPersistentMemory,
+    kEfiMaxMemoryType
+};
+
+inline bool operator==(uint32_t lhs, MemoryType rhs) {
+    return lhs == static_cast<uint32_t>(rhs);
+}
+
+inline bool operator==(MemoryType lhs, uint32_t rhs) { return rhs == lhs; }
+
+/** @brief UEFI のページサイズ (バイト) */
+const int kUEFIPageSize = 4096;
+#endif
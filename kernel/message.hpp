@@ -0,0 +1,36 @@
+/**
+ * @file message.hpp
+ *
+ * デバイスの処理からメインのタスクへ送るメッセージを定義する。
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "queue.hpp"
+
+/** @brief メインのタスクで処理してほしい出来事 */
+struct Message {
+    enum Type {
+        kMouseMove,
+        kKeyPush,
+    } type;
+
+    union {
+        struct {
+            int8_t displacement_x, displacement_y;
+        } mouse_move;
+
+        struct {
+            uint8_t keycode;
+        } keyboard;
+    } arg;
+};
+
+/** @brief デバイスの処理 (xHC のイベント処理) からメインのタスクへのキュー.
+ *
+ * 書き手は USB のタスクで動くクラスドライバから呼ばれるオブザーバだけ、
+ * 読み手はメインのタスクだけとする。
+ */
+using MessageQueue = SPSCQueue<Message, 256>;
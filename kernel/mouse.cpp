@@ -3,9 +3,7 @@
 #include "graphics.hpp"
 
 namespace {
-    // マウスカーソルの設定
-    const int kMouseCursorWidth = 15;
-    const int kMouseCursorHeight = 24;
+    // マウスカーソルの形
     const char mouse_cursor_shape[kMouseCursorHeight][kMouseCursorWidth + 1] = {
         "@              ",  //
         "@@             ",  //
@@ -32,44 +30,55 @@ namespace {
         "         @.@   ",  //
         "         @@@   ",  //
     };
+}  // namespace
 
-    void DrawMouseCursor(PixelWriter* pixel_writer, Vector2D<int> position) {
-        for (int dy = 0; dy < kMouseCursorHeight; dy++) {
-            for (int dx = 0; dx < kMouseCursorWidth; dx++) {
-                if (mouse_cursor_shape[dy][dx] == '@') {
-                    pixel_writer->Write(position.x + dx, position.y + dy,
-                                        {0, 0, 0});
-                } else if (mouse_cursor_shape[dy][dx] == '.') {
-                    pixel_writer->Write(position.x + dx, position.y + dy,
-                                        {255, 255, 255});
-                }
-            }
-        }
+template <class Writer>
+void DrawMouseCursor(Writer& writer, Vector2D<int> position) {
+    // カーソルの範囲をクリップ矩形と交差させ、内側のループでは範囲チェックをしない
+    const auto area =
+        Rectangle<int>{position, {kMouseCursorWidth, kMouseCursorHeight}} &
+        writer.Clip();
+    if (IsEmpty(area)) {
+        return;
     }
-
-    void EraseMouseCursor(PixelWriter* pixel_writer, Vector2D<int> position,
-                          PixelColor erase_color) {
-        for (int dy = 0; dy < kMouseCursorHeight; ++dy) {
-            for (int dx = 0; dx < kMouseCursorWidth; ++dx) {
-                if (mouse_cursor_shape[dy][dx] != ' ') {
-                    pixel_writer->Write(position.x + dx, position.y + dy,
-                                        erase_color);
-                }
+    const int left = area.pos.x - position.x;
+    const int top = area.pos.y - position.y;
+    const uint32_t edge = writer.Pack({0, 0, 0});
+    const uint32_t fill = writer.Pack({255, 255, 255});
+    for (int dy = top; dy < top + area.size.y; dy++) {
+        uint32_t* row = writer.PixelAt(position.x, position.y + dy);
+        for (int dx = left; dx < left + area.size.x; dx++) {
+            if (mouse_cursor_shape[dy][dx] == '@') {
+                row[dx] = edge;
+            } else if (mouse_cursor_shape[dy][dx] == '.') {
+                row[dx] = fill;
             }
         }
     }
-}  // namespace
-
-MouseCursor::MouseCursor(PixelWriter* writer, PixelColor erase_color,
-                         Vector2D<int> initial_position)
-    : pixel_writer_{writer},
-      erase_color_{erase_color},
-      position_{initial_position} {
-    DrawMouseCursor(pixel_writer_, position_);
 }
 
+// 描画先として使う Writer の型ごとに明示的に実体化する
+template void DrawMouseCursor(PixelWriter&, Vector2D<int>);
+template void DrawMouseCursor(RGBResv8BitPerColorPixelWriter&, Vector2D<int>);
+template void DrawMouseCursor(BGRResv8BitPerColorPixelWriter&, Vector2D<int>);
+
 void MouseCursor::MoveRelative(Vector2D<int> displacement) {
-    EraseMouseCursor(pixel_writer_, position_, erase_color_);
-    position_ += displacement;
-    DrawMouseCursor(pixel_writer_, position_);
-}
\ No newline at end of file
+    auto new_position = position_;
+    new_position += displacement;
+    new_position = Clamp(new_position);
+    if (new_position.x == position_.x && new_position.y == position_.y) {
+        return;
+    }
+    position_ = new_position;
+    // 移動前と移動後の範囲だけを合成し直す
+    layer_manager_->Move(layer_id_, position_);
+    layer_manager_->Draw();
+}
+
+Vector2D<int> MouseCursor::Clamp(Vector2D<int> pos) const {
+    // 画面の右端と下端の 1 ピクセル手前までは先端を動かせる
+    const int right = screen_.pos.x + screen_.size.x - 1;
+    const int bottom = screen_.pos.y + screen_.size.y - 1;
+    return {std::max(screen_.pos.x, std::min(pos.x, right)),
+            std::max(screen_.pos.y, std::min(pos.y, bottom))};
+}
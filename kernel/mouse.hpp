@@ -1,15 +1,50 @@
 #pragma once
 
 #include "graphics.hpp"
+#include "layer.hpp"
 
+// マウスカーソルの大きさ
+const int kMouseCursorWidth = 15;
+const int kMouseCursorHeight = 24;
+/** @brief マウスカーソルのレイヤーで透明として扱う色 */
+const PixelColor kMouseTransparentColor{0, 0, 1};
+
+// Writer の型ごとに実体化される (mouse.cpp で明示的に実体化している)
+template <class Writer>
+void DrawMouseCursor(Writer& writer, Vector2D<int> position);
+
+/** @brief マウスカーソルを専用のレイヤーとして表示する.
+ *
+ * カーソルの形はレイヤーに一度だけ描いておき、移動はレイヤーの移動で行う。
+ * 下にあるデスクトップやコンソールは合成時に元の内容で描き直されるので、
+ * カーソルを消すための塗りつぶしは要らない。
+ */
 class MouseCursor {
    public:
-    MouseCursor(PixelWriter* writer, PixelColor erase_color,
-                Vector2D<int> initial_position);
+    /** writer はカーソル用レイヤー (kMouseCursorWidth x kMouseCursorHeight)
+     * に描画するもの。Writer の具象型 (FrameBufferWriter<kFormat>) を渡すと、
+     * その型向けに実体化された DrawMouseCursor で描かれる。
+     * カーソルの先端 (レイヤーの左上) は screen の中から出ないようにする。
+     */
+    template <class Writer>
+    MouseCursor(Writer* writer, LayerManager* layer_manager,
+                unsigned int layer_id, Rectangle<int> screen,
+                Vector2D<int> initial_position)
+        : layer_manager_{layer_manager}, layer_id_{layer_id}, screen_{screen} {
+        writer->FillRect({0, 0}, {kMouseCursorWidth, kMouseCursorHeight},
+                         kMouseTransparentColor);
+        DrawMouseCursor(*writer, {0, 0});
+        position_ = Clamp(initial_position);
+        layer_manager_->Move(layer_id_, position_);
+    }
     void MoveRelative(Vector2D<int> displacement);
 
    private:
-    PixelWriter* pixel_writer_ = nullptr;
-    PixelColor erase_color_;
+    /** @brief pos を screen_ の中に収めた位置を返す */
+    Vector2D<int> Clamp(Vector2D<int> pos) const;
+
+    LayerManager* layer_manager_;
+    unsigned int layer_id_;
+    Rectangle<int> screen_;
     Vector2D<int> position_;
-};
\ No newline at end of file
+};
@@ -1,13 +1,24 @@
 #include <errno.h>
+#include <reent.h>
+#include <stdint.h>
 #include <sys/types.h>
 
 void _exit(void) {
     while (1) __asm__("hlt");
 }
 
+// ヒープとして使える範囲。InitializeHeap (heap.cpp) で設定される。
+extern uintptr_t program_break, program_break_end;
+
 caddr_t sbrk(int incr) {
-    errno = ENOMEM;
-    return (caddr_t)-1;
+    if (program_break == 0 || program_break + incr >= program_break_end) {
+        errno = ENOMEM;
+        return (caddr_t)-1;
+    }
+
+    caddr_t prev_break = (caddr_t)program_break;
+    program_break += incr;
+    return prev_break;
 }
 
 int getpid(void) { return 1; }
@@ -16,3 +27,23 @@ int kill(int pid, int sig) {
     errno = EINVAL;
     return -1;
 }
+
+// malloc は複数のタスクから呼ばれるので、使っている間は割り込みを禁止して
+// タスクが切り替わらないようにする. newlib は入れ子で呼ぶことがある
+static int malloc_lock_depth;
+static uint64_t malloc_lock_rflags;
+
+void __malloc_lock(struct _reent* reent) {
+    uint64_t rflags;
+    __asm__ volatile("pushfq\n\tpop %0\n\tcli" : "=r"(rflags) : : "memory");
+    if (malloc_lock_depth++ == 0) {
+        malloc_lock_rflags = rflags;
+    }
+}
+
+void __malloc_unlock(struct _reent* reent) {
+    // RFLAGS.IF が立っていたときだけ、割り込みを許可し直す
+    if (--malloc_lock_depth == 0 && (malloc_lock_rflags & (1u << 9))) {
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
@@ -33,6 +33,57 @@ namespace {
 
     Error ScanBus(uint8_t bus);
 
+    /** @brief dev の MSI ケーパビリティ構造を cap_addr から読む */
+    MSICapability ReadMSICapability(const Device& dev, uint8_t cap_addr) {
+        MSICapability msi_cap{};
+
+        msi_cap.header.data = ReadConfReg(dev, cap_addr);
+        msi_cap.msg_addr = ReadConfReg(dev, cap_addr + 4);
+
+        uint8_t msg_data_addr = cap_addr + 8;
+        if (msi_cap.header.bits.addr_64_capable) {
+            msi_cap.msg_upper_addr = ReadConfReg(dev, cap_addr + 8);
+            msg_data_addr = cap_addr + 12;
+        }
+        msi_cap.msg_data = ReadConfReg(dev, msg_data_addr);
+        return msi_cap;
+    }
+
+    void WriteMSICapability(const Device& dev, uint8_t cap_addr,
+                            const MSICapability& msi_cap) {
+        WriteConfReg(dev, cap_addr, msi_cap.header.data);
+        WriteConfReg(dev, cap_addr + 4, msi_cap.msg_addr);
+
+        uint8_t msg_data_addr = cap_addr + 8;
+        if (msi_cap.header.bits.addr_64_capable) {
+            WriteConfReg(dev, cap_addr + 8, msi_cap.msg_upper_addr);
+            msg_data_addr = cap_addr + 12;
+        }
+        WriteConfReg(dev, msg_data_addr, msi_cap.msg_data);
+    }
+
+    Error ConfigureMSIRegister(const Device& dev, uint8_t cap_addr,
+                               uint32_t msg_addr, uint32_t msg_data,
+                               unsigned int num_vector_exponent) {
+        auto msi_cap = ReadMSICapability(dev, cap_addr);
+
+        // デバイスが対応する以上のベクタは割り当てられない
+        if (msi_cap.header.bits.multi_msg_capable <= num_vector_exponent) {
+            msi_cap.header.bits.multi_msg_enable =
+                msi_cap.header.bits.multi_msg_capable;
+        } else {
+            msi_cap.header.bits.multi_msg_enable = num_vector_exponent;
+        }
+
+        msi_cap.header.bits.msi_enable = 1;
+        msi_cap.msg_addr = msg_addr;
+        msi_cap.msg_upper_addr = 0;
+        msi_cap.msg_data = msg_data;
+
+        WriteMSICapability(dev, cap_addr, msi_cap);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
     /** @brief 指定のファンクション番号のファンクションをスキャンする。
      * もし PCI-PCIブリッジなら、セカンダリバスに対し ScanBusを実行する
      */
@@ -213,4 +264,39 @@ namespace pci {
                 MAKE_ERROR(Error::kSuccess)};
     }
 
+    Error ConfigureMSI(const Device& dev, uint32_t msg_addr, uint32_t msg_data,
+                       unsigned int num_vector_exponent) {
+        // ステータスレジスタのビット 4 が立っていればケーパビリティリストがある
+        if ((ReadConfReg(dev, 0x04) & (1u << 20)) == 0) {
+            return MAKE_ERROR(Error::kNoPCIMSI);
+        }
+
+        // ケーパビリティリストの先頭は 0x34 に書かれている
+        uint8_t cap_addr = ReadConfReg(dev, 0x34) & 0xfcu;
+        while (cap_addr != 0) {
+            CapabilityHeader header;
+            header.data = ReadConfReg(dev, cap_addr);
+            if (header.bits.cap_id == kCapabilityMSI) {
+                return ConfigureMSIRegister(dev, cap_addr, msg_addr, msg_data,
+                                            num_vector_exponent);
+            }
+            cap_addr = header.bits.next_ptr & 0xfcu;
+        }
+        return MAKE_ERROR(Error::kNoPCIMSI);
+    }
+
+    Error ConfigureMSIFixedDestination(const Device& dev, uint8_t apic_id,
+                                       MSITriggerMode trigger_mode,
+                                       MSIDeliveryMode delivery_mode,
+                                       uint8_t vector,
+                                       unsigned int num_vector_exponent) {
+        // 0xfee00000 からの領域に書くと Local APIC への割り込みになる
+        const uint32_t msg_addr = 0xfee00000u | (apic_id << 12);
+        uint32_t msg_data =
+            (static_cast<uint32_t>(delivery_mode) << 8) | vector;
+        if (trigger_mode == MSITriggerMode::kLevel) {
+            msg_data |= 0xc000;
+        }
+        return ConfigureMSI(dev, msg_addr, msg_data, num_vector_exponent);
+    }
 }  // namespace pci
@@ -88,4 +88,69 @@ namespace pci {
     }
 
     WithError<uint64_t> ReadBar(Device& device, unsigned int bar_index);
+
+    /** @brief PCI ケーパビリティレジスタの共通ヘッダ */
+    union CapabilityHeader {
+        uint32_t data;
+        struct {
+            uint32_t cap_id : 8;
+            uint32_t next_ptr : 8;
+            uint32_t cap : 16;
+        } __attribute__((packed)) bits;
+    } __attribute__((packed));
+
+    const uint8_t kCapabilityMSI = 0x05;
+    const uint8_t kCapabilityMSIX = 0x11;
+
+    /** @brief MSI ケーパビリティ構造.
+     *
+     * 64 ビットアドレスに対応するかどうかで msg_data の位置が変わる。
+     */
+    struct MSICapability {
+        union {
+            uint32_t data;
+            struct {
+                uint32_t cap_id : 8;
+                uint32_t next_ptr : 8;
+                uint32_t msi_enable : 1;
+                uint32_t multi_msg_capable : 3;
+                uint32_t multi_msg_enable : 3;
+                uint32_t addr_64_capable : 1;
+                uint32_t per_vector_mask_capable : 1;
+                uint32_t : 7;
+            } __attribute__((packed)) bits;
+        } __attribute__((packed)) header;
+
+        uint32_t msg_addr;
+        uint32_t msg_upper_addr;
+        uint32_t msg_data;
+    } __attribute__((packed));
+
+    enum class MSITriggerMode { kEdge = 0, kLevel = 1 };
+
+    enum class MSIDeliveryMode {
+        kFixed = 0b000,
+        kLowestPriority = 0b001,
+        kSMI = 0b010,
+        kNMI = 0b100,
+        kINIT = 0b101,
+        kExtINT = 0b111,
+    };
+
+    /** @brief MSI を設定する.
+     *
+     * 割り込みのたびに msg_addr へ msg_data が書き込まれる。
+     * num_vector_exponent は割り当てるベクタ数の 2 を底とする対数。
+     *
+     * @return MSI ケーパビリティが無ければ Error::kNoPCIMSI
+     */
+    Error ConfigureMSI(const Device& dev, uint32_t msg_addr, uint32_t msg_data,
+                       unsigned int num_vector_exponent);
+
+    /** @brief 割り込み先の CPU (Local APIC ID) を固定して MSI を設定する */
+    Error ConfigureMSIFixedDestination(const Device& dev, uint8_t apic_id,
+                                       MSITriggerMode trigger_mode,
+                                       MSIDeliveryMode delivery_mode,
+                                       uint8_t vector,
+                                       unsigned int num_vector_exponent);
 }  // namespace pci
\ No newline at end of file
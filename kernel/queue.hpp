@@ -0,0 +1,85 @@
+/**
+ * @file queue.hpp
+ *
+ * 書き手と読み手が 1 つずつの、ロックを取らない固定長のキューを提供する。
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+#include "error.hpp"
+
+/** @brief 要素 T を最大 N 個保持する単一生産者・単一消費者のキュー.
+ *
+ * Push を呼ぶ文脈 (割り込みハンドラやドライバ) と、Pop を呼ぶ文脈
+ * (メインループ) はそれぞれ 1 つに限る。その条件の下では、
+ * 割り込みを禁止したりロックを取ったりせずに使える。
+ * N は 2 のべき乗であること。
+ */
+template <class T, size_t N>
+class SPSCQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "N must be a power of 2");
+
+   public:
+    /** @brief 末尾に value を追加する.
+     *
+     * @return 満杯なら Error::kFull
+     */
+    Error Push(const T& value) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == N) {
+            return MAKE_ERROR(Error::kFull);
+        }
+        data_[head % N] = value;
+        head_.store(head + 1, std::memory_order_release);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    /** @brief 先頭から 1 つ取り出して value に書く.
+     *
+     * @return 空なら Error::kEmpty
+     */
+    Error Pop(T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) {
+            return MAKE_ERROR(Error::kEmpty);
+        }
+        value = data_[tail % N];
+        tail_.store(tail + 1, std::memory_order_release);
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    /** @brief 先頭から最大 max_count 個をまとめて取り出して values に書く.
+     *
+     * 読み出し位置の更新は最後に 1 回だけ行う。
+     * @return 取り出した個数
+     */
+    size_t PopBatch(T* values, size_t max_count) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        const size_t head = head_.load(std::memory_order_acquire);
+        const size_t count =
+            head - tail < max_count ? head - tail : max_count;
+        for (size_t i = 0; i < count; ++i) {
+            values[i] = data_[(tail + i) % N];
+        }
+        tail_.store(tail + count, std::memory_order_release);
+        return count;
+    }
+
+    bool Empty() const {
+        return tail_.load(std::memory_order_relaxed) ==
+               head_.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t Capacity() { return N; }
+
+   private:
+    std::array<T, N> data_{};
+    // 書き込み位置と読み出し位置. 単調に増え、N で割った余りで使う.
+    // 書き手と読み手が別々に更新するので、キャッシュラインを分けておく
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
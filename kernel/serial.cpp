@@ -0,0 +1,121 @@
+#include "serial.hpp"
+
+#include <cstring>
+
+#include "asmfunc.h"
+
+namespace {
+    // レジスタのオフセット. DLAB = 1 のときは 0, 1 が分周比になる
+    const uint16_t kData = 0;
+    const uint16_t kInterruptEnable = 1;
+    const uint16_t kDivisorLow = 0;
+    const uint16_t kDivisorHigh = 1;
+    const uint16_t kFifoControl = 2;
+    const uint16_t kInterruptIdentification = 2;
+    const uint16_t kLineControl = 3;
+    const uint16_t kModemControl = 4;
+    const uint16_t kLineStatus = 5;
+
+    const uint8_t kLineControlDLAB = 0x80;
+    const uint8_t kLineControl8N1 = 0x03;
+    // FIFO 有効, 送受信 FIFO クリア, 受信の閾値 14 バイト
+    const uint8_t kFifoEnableAndClear = 0xc7;
+    // DTR, RTS, OUT2 (OUT2 は割り込み線を有効にする)
+    const uint8_t kModemControlNormal = 0x0b;
+    const uint8_t kModemControlLoopback = 0x1e;
+    const uint8_t kInterruptTHRE = 0x02;
+    const uint8_t kLineStatusTHRE = 0x20;
+
+    const uint32_t kBaseClock = 115200;
+}  // namespace
+
+SerialPort::SerialPort(uint16_t base) : base_{base} {}
+
+Error SerialPort::Initialize(uint32_t baud_rate) {
+    const uint16_t divisor = kBaseClock / baud_rate;
+
+    IoOut8(base_ + kInterruptEnable, 0);
+    IoOut8(base_ + kLineControl, kLineControlDLAB);
+    IoOut8(base_ + kDivisorLow, divisor & 0xffu);
+    IoOut8(base_ + kDivisorHigh, divisor >> 8);
+    IoOut8(base_ + kLineControl, kLineControl8N1);
+    IoOut8(base_ + kFifoControl, kFifoEnableAndClear);
+
+    // 折り返しモードで送った値が読めなければ UART は無い
+    IoOut8(base_ + kModemControl, kModemControlLoopback);
+    IoOut8(base_ + kData, 0xae);
+    if (IoIn8(base_ + kData) != 0xae) {
+        return MAKE_ERROR(Error::kUnknownDevice);
+    }
+    IoOut8(base_ + kModemControl, kModemControlNormal);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void SerialPort::EnableInterrupt(bool enable) {
+    IoOut8(base_ + kInterruptEnable, enable ? kInterruptTHRE : 0);
+    // 割り込みは送信保持レジスタが空になったときにしか起きないので、
+    // 既に空なら最初の送信はここで始める
+    FillFifo();
+}
+
+void SerialPort::OnInterrupt() {
+    // 割り込み要因を読むと送信保持レジスタ空き割り込みは取り下げられる
+    IoIn8(base_ + kInterruptIdentification);
+    FillFifo();
+}
+
+size_t SerialPort::Write(const char* s, size_t len) {
+    size_t i = 0;
+    for (; i < len; ++i) {
+        if (s[i] == '\n' && !Push('\r')) {
+            break;
+        }
+        if (!Push(s[i])) {
+            break;
+        }
+    }
+    FillFifo();
+    return i;
+}
+
+size_t SerialPort::Write(const char* s) { return Write(s, strlen(s)); }
+
+void SerialPort::Flush() {
+    while (tail_.load(std::memory_order_acquire) !=
+           head_.load(std::memory_order_relaxed)) {
+        FillFifo();
+    }
+}
+
+bool SerialPort::Push(char c) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) == kQueueSize) {
+        return false;
+    }
+    queue_[head % kQueueSize] = c;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void SerialPort::FillFifo() {
+    do {
+        // Write の途中で割り込まれた場合など、既に誰かが送っていれば
+        // やり直しを頼んで任せる
+        if (filling_.test_and_set(std::memory_order_acquire)) {
+            retry_.store(true, std::memory_order_relaxed);
+            return;
+        }
+        retry_.store(false, std::memory_order_relaxed);
+
+        if (IoIn8(base_ + kLineStatus) & kLineStatusTHRE) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            const size_t head = head_.load(std::memory_order_acquire);
+            for (int i = 0; i < kFifoDepth && tail != head; ++i, ++tail) {
+                IoOut8(base_ + kData, queue_[tail % kQueueSize]);
+            }
+            tail_.store(tail, std::memory_order_release);
+        }
+
+        filling_.clear(std::memory_order_release);
+    } while (retry_.load(std::memory_order_relaxed));
+}
@@ -0,0 +1,80 @@
+/**
+ * @file serial.hpp
+ *
+ * 16550 互換のシリアルポート (UART) の送信を扱う。
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/** @brief COM1 の IO ポートアドレス */
+const uint16_t kCOM1 = 0x03f8;
+
+/** @brief 16550 互換 UART の送信側.
+ *
+ * Write は送信キュー (リングバッファ) に積むだけで、UART の送信待ちはしない。
+ * キューの中身は送信保持レジスタが空になるたびに、送信 FIFO (16 バイト) へ
+ * まとめて書き込む。これは送信保持レジスタ空き割り込み (THRE) の
+ * ハンドラから呼ぶ OnInterrupt か、割り込みを使わない場合は
+ * メインループの空き時間に呼ぶ Poll で行う。
+ * Write を呼ぶのは 1 か所 (DrainLog など) に限ること。
+ */
+class SerialPort {
+   public:
+    /** @brief 送信キューの大きさ. 2 のべき乗 */
+    static const size_t kQueueSize = 16 * 1024;
+    /** @brief 送信 FIFO の段数 */
+    static const int kFifoDepth = 16;
+
+    SerialPort(uint16_t base);
+
+    /** @brief ボーレート baud_rate, 8N1 で UART を初期化し、FIFO を有効にする.
+     *
+     * @return 折り返しテストに失敗した (UART が無い) 場合は Error::kUnknownDevice
+     */
+    Error Initialize(uint32_t baud_rate = 115200);
+
+    /** @brief 送信保持レジスタ空き割り込みを有効, または無効にする.
+     *
+     * 有効にする前に、割り込みハンドラから OnInterrupt が呼ばれるように
+     * しておくこと。
+     */
+    void EnableInterrupt(bool enable);
+
+    /** @brief s の len バイトを送信キューに積む.
+     *
+     * 改行 '\n' は "\r\n" に変換する。
+     * キューが一杯になったら残りは捨てる。
+     * @return キューに積んだ元の文字列のバイト数
+     */
+    size_t Write(const char* s, size_t len);
+    /** @brief ヌル終端された文字列 s を送信キューに積む */
+    size_t Write(const char* s);
+
+    /** @brief 送信保持レジスタ空き割り込みのハンドラから呼ぶ */
+    void OnInterrupt();
+    /** @brief 割り込みを使わない場合に、メインループの空き時間に呼ぶ */
+    void Poll() { FillFifo(); }
+
+    /** @brief 送信キューが空になるまで待つ. 停止する前などに使う */
+    void Flush();
+
+   private:
+    uint16_t base_;
+    char queue_[kQueueSize];
+    // 書き込み位置と読み出し位置. 単調に増え、kQueueSize で割った余りで使う
+    std::atomic<size_t> head_{0}, tail_{0};
+    // FillFifo の多重実行を防ぐ
+    std::atomic_flag filling_ = ATOMIC_FLAG_INIT;
+    // FillFifo の実行中に割り込みが来たことを示す. 実行中の側がやり直す
+    std::atomic<bool> retry_{false};
+
+    bool Push(char c);
+    /** @brief 送信保持レジスタが空なら、キューから最大 kFifoDepth バイト送る */
+    void FillFifo();
+};
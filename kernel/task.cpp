@@ -0,0 +1,155 @@
+#include "task.hpp"
+
+#include <cstdlib>
+
+#include "asmfunc.h"
+#include "interrupt.hpp"
+#include "trace.hpp"
+
+namespace {
+    // 新しいタスクの RFLAGS. 割り込みを許可した状態で動き始める
+    const uint64_t kInitialRFLAGS = 0x202;
+    // FXSAVE 領域の初期値. FPU と SSE の例外はすべてマスクしておく
+    const uint16_t kInitialFCW = 0x037f;
+    const uint32_t kInitialMXCSR = 0x1f80;
+
+    /** @brief すべてのタスクの入口. f から戻ってきたら眠り続ける */
+    [[noreturn]] void TaskEntry(TaskFunc* f, uint64_t task_id, int64_t data) {
+        f(task_id, data);
+        // 誰からも起こされないので、Sleep からは戻ってこない
+        __asm__("cli");
+        while (1) task_manager->Sleep();
+    }
+
+    void TaskIdle(uint64_t task_id, int64_t data) {
+        while (1) __asm__("hlt");
+    }
+}  // namespace
+
+TaskManager::TaskManager(int level) : current_level_{level} {
+    Task& main_task = tasks_[num_tasks_++];
+    main_task.id_ = 0;
+    main_task.level_ = level;
+    main_task.running_ = true;
+    PushBack(main_task);
+
+    auto [idle, err] = NewTask(TaskIdle, 0, 0);
+    if (!err) {
+        Wakeup(*idle);
+    }
+}
+
+WithError<Task*> TaskManager::NewTask(TaskFunc* f, int64_t data, int level) {
+    InterruptGuard guard;
+    if (num_tasks_ == kMaxTasks) {
+        return {nullptr, MAKE_ERROR(Error::kFull)};
+    }
+    // スタックはタスクが動いている間ずっと使うので解放しない
+    auto stack = reinterpret_cast<uint8_t*>(malloc(Task::kStackBytes));
+    if (stack == nullptr) {
+        return {nullptr, MAKE_ERROR(Error::kNoEnoughMemory)};
+    }
+
+    Task& task = tasks_[num_tasks_];
+    task.id_ = num_tasks_++;
+    task.level_ = level;
+
+    TaskContext& ctx = task.context_;
+    ctx = TaskContext{};
+    ctx.cr3 = GetCR3();
+    ctx.rflags = kInitialRFLAGS;
+    ctx.cs = GetCS();
+    ctx.ss = GetSS();
+    ctx.rip = reinterpret_cast<uint64_t>(TaskEntry);
+    ctx.rdi = reinterpret_cast<uint64_t>(f);
+    ctx.rsi = task.id_;
+    ctx.rdx = data;
+
+    // call 直後と同じく、RSP + 8 が 16 バイト境界になるようにする.
+    // TaskEntry は戻らないので、戻り先には 0 を置いておく
+    const uint64_t stack_end =
+        (reinterpret_cast<uint64_t>(stack) + Task::kStackBytes) & ~0xfull;
+    ctx.rsp = stack_end - 8;
+    *reinterpret_cast<uint64_t*>(ctx.rsp) = 0;
+
+    *reinterpret_cast<uint16_t*>(&ctx.fxsave_area[0]) = kInitialFCW;
+    *reinterpret_cast<uint32_t*>(&ctx.fxsave_area[24]) = kInitialMXCSR;
+
+    return {&task, MAKE_ERROR(Error::kSuccess)};
+}
+
+void TaskManager::Wakeup(Task& task) {
+    InterruptGuard guard;
+    if (task.running_) {
+        return;
+    }
+    task.running_ = true;
+    PushBack(task);
+    if (task.level_ > current_level_) {
+        level_changed_ = true;
+    }
+}
+
+void TaskManager::Sleep() {
+    InterruptGuard guard;
+    SwitchTask(true);
+}
+
+void TaskManager::RotateOnTick() {
+    InterruptGuard guard;
+    SwitchTask(false);
+}
+
+void TaskManager::Preempt() {
+    InterruptGuard guard;
+    if (level_changed_) {
+        SwitchTask(false);
+    }
+}
+
+Task& TaskManager::CurrentTask() { return *heads_[current_level_]; }
+
+void TaskManager::SwitchTask(bool sleep) {
+    Task* current = heads_[current_level_];
+    heads_[current_level_] = current->next_;
+    if (heads_[current_level_] == nullptr) {
+        tails_[current_level_] = nullptr;
+    }
+    current->next_ = nullptr;
+
+    if (sleep) {
+        current->running_ = false;
+    } else {
+        PushBack(*current);
+    }
+
+    if (heads_[current_level_] == nullptr) {
+        level_changed_ = true;
+    }
+    if (level_changed_) {
+        level_changed_ = false;
+        // アイドルタスクは眠らないので、優先度 0 の列は空にならない
+        for (int level = kMaxLevel; level >= 0; --level) {
+            if (heads_[level]) {
+                current_level_ = level;
+                break;
+            }
+        }
+    }
+
+    Task* next = heads_[current_level_];
+    if (next != current) {
+        TRACE(kTraceTaskSwitch, current->id_, next->id_);
+        SwitchContext(&next->context_, &current->context_);
+    }
+}
+
+void TaskManager::PushBack(Task& task) {
+    Task*& tail = tails_[task.level_];
+    if (tail) {
+        tail->next_ = &task;
+    } else {
+        heads_[task.level_] = &task;
+    }
+    tail = &task;
+}
@@ -0,0 +1,139 @@
+/**
+ * @file task.hpp
+ *
+ * タスク (独立したスタックを持つ実行の流れ) の切り替えを提供する。
+ */
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "error.hpp"
+
+/** @brief 中断したタスクのレジスタの内容.
+ *
+ * SwitchContext (asmfunc.asm) がオフセットを決め打ちで読み書きするので、
+ * メンバの並びを変えないこと。fxsave_area は 16 バイト境界に置く。
+ */
+struct TaskContext {
+    uint64_t cr3, rip, rflags, reserved1;             // offset 0x00
+    uint64_t cs, ss, fs, gs;                          // offset 0x20
+    uint64_t rax, rbx, rcx, rdx, rdi, rsi, rsp, rbp;  // offset 0x40
+    uint64_t r8, r9, r10, r11, r12, r13, r14, r15;    // offset 0x80
+    std::array<uint8_t, 512> fxsave_area;             // offset 0xc0
+} __attribute__((packed));
+static_assert(sizeof(TaskContext) == 0xc0 + 512);
+
+/** @brief タスクの本体. data は TaskManager::NewTask に渡した値.
+ *
+ * 戻ってきたタスクは二度と動かない。
+ */
+using TaskFunc = void(uint64_t task_id, int64_t data);
+
+class Task {
+   public:
+    /** @brief タスク 1 つあたりのスタックの大きさ */
+    static const size_t kStackBytes = 64 * 1024;
+
+    Task() = default;
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    uint64_t ID() const { return id_; }
+    /** @brief 優先度. 大きいほど優先される */
+    int Level() const { return level_; }
+    /** @brief 実行中か、実行を待っていれば true. 眠っていれば false */
+    bool Running() const { return running_; }
+
+   private:
+    friend class TaskManager;
+
+    alignas(16) TaskContext context_{};
+    uint64_t id_{0};
+    int level_{0};
+    bool running_{false};
+    // 同じ優先度の実行待ちの列で、次に動くタスク
+    Task* next_{nullptr};
+};
+
+/** @brief 優先度付きのラウンドロビンでタスクを切り替える.
+ *
+ * 実行待ちのタスクのうち最も優先度の高いものを動かし、
+ * 同じ優先度のタスクはタイマ割り込みのたびに順番に切り替える。
+ * 優先度の低いタスクは、高いタスクがすべて眠っている間だけ動く。
+ * どのタスクも動けないときは、優先度 0 のアイドルタスクが hlt で待つ。
+ *
+ * 状態は割り込みを禁止して変更するので、割り込みハンドラからも呼べる。
+ * CPU は 1 つだけ使うことを前提にしている。
+ */
+class TaskManager {
+   public:
+    static const int kMaxTasks = 16;
+    /** @brief 優先度の最大値. アイドルタスクは 0 */
+    static const int kMaxLevel = 3;
+
+    /** @brief 呼び出したときの実行の流れを、優先度 level のタスクにする */
+    explicit TaskManager(int level);
+    TaskManager(const TaskManager&) = delete;
+    TaskManager& operator=(const TaskManager&) = delete;
+
+    /** @brief f(id, data) を実行するタスクを優先度 level で作る.
+     *
+     * 作ったタスクは眠っているので、Wakeup で動かし始める。
+     *
+     * @return タスクの数が kMaxTasks を超える場合は Error::kFull、
+     *         スタックを確保できなければ Error::kNoEnoughMemory
+     */
+    WithError<Task*> NewTask(TaskFunc* f, int64_t data, int level);
+
+    /** @brief 眠っている task を実行待ちにする. 実行中なら何もしない.
+     *
+     * その場では切り替えない。task の方が今のタスクより優先度が高ければ、
+     * 次の Preempt, RotateOnTick, Sleep のいずれかで切り替わる。
+     */
+    void Wakeup(Task& task);
+
+    /** @brief 今のタスクを眠らせ、他のタスクに切り替える.
+     *
+     * Wakeup で起こされるとここから戻る。起こされる条件を確かめてから
+     * 眠るまでの間に起こされた場合に取りこぼさないよう、
+     * 割り込みを禁止して確かめてから呼ぶこと (戻った後も禁止されたまま)。
+     */
+    void Sleep();
+
+    /** @brief 同じ優先度の次のタスクに切り替える.
+     *
+     * タイマ割り込みのハンドラから、EOI を送った後に呼ぶ。
+     */
+    void RotateOnTick();
+
+    /** @brief 割り込みハンドラの中で優先度の高いタスクを起こしていれば切り替える.
+     *
+     * 割り込みハンドラの最後で、EOI を送った後に呼ぶ。
+     */
+    void Preempt();
+
+    Task& CurrentTask();
+
+   private:
+    /** @brief 今のタスクを列から外して (sleep なら眠らせて) 次のタスクへ切り替える.
+     *
+     * 割り込みを禁止して呼ぶ。
+     */
+    void SwitchTask(bool sleep);
+    void PushBack(Task& task);
+
+    std::array<Task, kMaxTasks> tasks_;
+    int num_tasks_{0};
+    // 優先度ごとの実行待ちの列. 先頭が動いている (次に動く) タスク
+    std::array<Task*, kMaxLevel + 1> heads_{};
+    std::array<Task*, kMaxLevel + 1> tails_{};
+    // 今動いているタスクの優先度
+    int current_level_;
+    // より優先度の高いタスクが起きたか、今の優先度の列が空になった
+    bool level_changed_{false};
+};
+
+extern TaskManager* task_manager;
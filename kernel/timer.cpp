@@ -0,0 +1,204 @@
+#include "timer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+
+#include "asmfunc.h"
+#include "clock.hpp"
+#include "interrupt.hpp"
+#include "timer_wheel.hpp"
+
+namespace {
+    // Local APIC のタイマ関係のレジスタのオフセット
+    const uintptr_t kLVTTimer = 0x320;
+    const uintptr_t kInitialCount = 0x380;
+    const uintptr_t kCurrentCount = 0x390;
+    const uintptr_t kDivideConfig = 0x3e0;
+
+    volatile uint32_t& LAPICRegister(uintptr_t offset) {
+        return *reinterpret_cast<volatile uint32_t*>(0xfee00000 + offset);
+    }
+
+    const uint32_t kDivideBy1 = 0b1011;
+    const uint32_t kLVTMasked = 1u << 16;
+    const uint32_t kLVTOneShot = 0b00u << 17;
+    const uint32_t kLVTTSCDeadline = 0b10u << 17;
+
+    const uint32_t kIA32TSCDeadline = 0x6e0;
+    const uint64_t kNsPerSec = 1'000'000'000;
+    // 次のティックや予約された期限が無いことを表す TSC の値
+    const uint64_t kNoDeadline = UINT64_MAX;
+
+    /** @brief 周波数を求めるときにタイマを動かす時間 */
+    const uint64_t kCalibrationNs = 10'000'000;
+    const int kMaxCallbacks = 8;
+
+    uint64_t lapic_timer_frequency = 0;
+    // TSC デッドラインモードで動かしていれば true, ワンショットモードなら false
+    bool tsc_deadline = false;
+    std::atomic<uint64_t> tick{0};
+    std::atomic<bool> tick_running{false};
+
+    // 次のティックと、StartLAPICTimerOneShot で予約された期限 (TSC の値).
+    // 割り込みのたびに、早い方で次の割り込みが起きるように設定し直す
+    uint64_t tick_period_cycles = 0;
+    uint64_t next_tick_tsc = kNoDeadline;
+    uint64_t one_shot_tsc = kNoDeadline;
+    void (*one_shot_callback)() = nullptr;
+    // TSC の周波数が分からないときに仮定する周波数 (1 ナノ秒あたりのサイクル数)
+    const uint64_t kFallbackCyclesPerNs = 4;
+
+    std::array<TimerCallback, kMaxCallbacks> callbacks{};
+    std::atomic<int> num_callbacks{0};
+
+    /** @brief 次のティックと予約された期限の早い方で割り込むように設定する.
+     *
+     * 割り込みを禁止して呼ぶ。
+     */
+    void ArmLAPICTimer() {
+        const uint64_t target = std::min(next_tick_tsc, one_shot_tsc);
+        if (tsc_deadline) {
+            // 0 を書くとタイマが止まる. 過ぎた時刻ならすぐに割り込む
+            WriteMSR(kIA32TSCDeadline, target == kNoDeadline ? 0 : target);
+            return;
+        }
+
+        if (target == kNoDeadline) {
+            LAPICRegister(kInitialCount) = 0;
+            return;
+        }
+        // 1 秒より先の期限は途中で一度割り込ませ、そこで設定し直す
+        const uint64_t now = ReadTSC();
+        const uint64_t cycles =
+            target > now ? std::min(target - now, TSCFrequency()) : 0;
+        // 期限より前に割り込まないよう切り上げる
+        const uint64_t ns = CyclesToNanoseconds(cycles);
+        const uint64_t count =
+            (ns * lapic_timer_frequency + kNsPerSec - 1) / kNsPerSec;
+        // 0 を書くとタイマが止まるので、最短でも 1 カウントにする
+        LAPICRegister(kInitialCount) =
+            std::clamp<uint64_t>(count, 1, UINT32_MAX);
+    }
+}  // namespace
+
+Error InitializeLAPICTimer() {
+    if (TSCFrequency() == 0) {
+        return MAKE_ERROR(Error::kUnknownDevice);
+    }
+
+    LAPICRegister(kDivideConfig) = kDivideBy1;
+    LAPICRegister(kLVTTimer) = kLVTMasked | kLVTOneShot;
+    LAPICRegister(kInitialCount) = UINT32_MAX;
+
+    const uint64_t end = ReadTSC() + NanosecondsToCycles(kCalibrationNs);
+    while (ReadTSC() < end) {
+    }
+    const uint32_t elapsed = UINT32_MAX - LAPICRegister(kCurrentCount);
+    LAPICRegister(kInitialCount) = 0;
+    if (elapsed == 0) {
+        return MAKE_ERROR(Error::kUnknownDevice);
+    }
+
+    lapic_timer_frequency = elapsed * (kNsPerSec / kCalibrationNs);
+
+    // 期限を設定するまでは割り込みは起きない
+    tsc_deadline = HasTSCDeadline();
+    if (tsc_deadline) {
+        LAPICRegister(kLVTTimer) =
+            kLVTTSCDeadline | InterruptVector::kLAPICTimer;
+        // LVT をデッドラインモードにする書き込みが、IA32_TSC_DEADLINE への
+        // WRMSR より先に届くようにする (Intel SDM 10.5.4.1)
+        __asm__ volatile("mfence" ::: "memory");
+    } else {
+        LAPICRegister(kLVTTimer) = kLVTOneShot | InterruptVector::kLAPICTimer;
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void StartLAPICTimerPeriodic() {
+    InterruptGuard guard;
+    tick_period_cycles = NanosecondsToCycles(kNsPerSec / kTimerFrequency);
+    next_tick_tsc = ReadTSC() + tick_period_cycles;
+    tick_running.store(true, std::memory_order_relaxed);
+    ArmLAPICTimer();
+}
+
+void StartLAPICTimerOneShot(uint64_t ns, void (*callback)()) {
+    InterruptGuard guard;
+    one_shot_callback = callback;
+    one_shot_tsc = ReadTSC() + NanosecondsToCycles(ns);
+    ArmLAPICTimer();
+}
+
+void CancelLAPICTimerOneShot() {
+    InterruptGuard guard;
+    one_shot_callback = nullptr;
+    one_shot_tsc = kNoDeadline;
+    ArmLAPICTimer();
+}
+
+bool HasTSCDeadline() {
+    uint32_t regs[4];
+    ReadCPUID(1, 0, regs);
+    return regs[2] & (1u << 24);
+}
+
+uint64_t CurrentTick() { return tick.load(std::memory_order_relaxed); }
+
+bool TickRunning() { return tick_running.load(std::memory_order_relaxed); }
+
+void YieldUntilNextTick() {
+    // 割り込みが禁止されているとティックで起こされないので、眠れない
+    if (timer_wheel && InterruptsEnabled()) {
+        timer_wheel->SleepUntil(CurrentTick() + 1);
+    } else {
+        __asm__("pause");
+    }
+}
+
+uint64_t TimeoutCycles(uint64_t timeout_ms) {
+    const uint64_t ns = timeout_ms * 1'000'000;
+    if (TSCFrequency() == 0) {
+        return ns * kFallbackCyclesPerNs;
+    }
+    return NanosecondsToCycles(ns);
+}
+
+Error AddTimerCallback(TimerCallback callback) {
+    const int n = num_callbacks.load(std::memory_order_relaxed);
+    if (n == kMaxCallbacks) {
+        return MAKE_ERROR(Error::kFull);
+    }
+    callbacks[n] = callback;
+    // 割り込みハンドラからは、数を増やした時点で関数が見えるようにする
+    num_callbacks.store(n + 1, std::memory_order_release);
+    return MAKE_ERROR(Error::kSuccess);
+}
+
+void LAPICTimerOnInterrupt() {
+    const uint64_t now = ReadTSC();
+    if (now >= one_shot_tsc) {
+        // 関数の中で予約し直せるように、呼ぶ前に外しておく
+        auto callback = one_shot_callback;
+        one_shot_callback = nullptr;
+        one_shot_tsc = kNoDeadline;
+        if (callback) {
+            callback();
+        }
+    }
+
+    if (now >= next_tick_tsc) {
+        // 割り込みが遅れて何周期分か過ぎていたら、その分まとめて進める
+        const uint64_t elapsed =
+            (now - next_tick_tsc) / tick_period_cycles + 1;
+        next_tick_tsc += elapsed * tick_period_cycles;
+        const uint64_t t =
+            tick.fetch_add(elapsed, std::memory_order_relaxed) + elapsed;
+        const int n = num_callbacks.load(std::memory_order_acquire);
+        for (int i = 0; i < n; ++i) {
+            callbacks[i](t);
+        }
+    }
+    ArmLAPICTimer();
+}
@@ -0,0 +1,119 @@
+/**
+ * @file timer.hpp
+ *
+ * Local APIC タイマによる時間の管理を提供する。
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "asmfunc.h"
+#include "error.hpp"
+
+/** @brief ティックの頻度 (Hz). 1 ティックは 10 ミリ秒 */
+const int kTimerFrequency = 100;
+
+/** @brief Local APIC タイマの周波数を TSC と比べて求める.
+ *
+ * InitializeClock の後、タイマを使い始める前に一度だけ呼ぶ。
+ * CPU が対応していれば TSC デッドラインモード、そうでなければワンショット
+ * モードにしておく。期限はまだ設定しないので、割り込みは起きない。
+ *
+ * @return TSC の周波数が分からないか、タイマが進まない場合は Error::kUnknownDevice
+ */
+Error InitializeLAPICTimer();
+
+/** @brief kTimerFrequency Hz でティックを進め始める.
+ *
+ * ティックごとに AddTimerCallback で登録した関数を呼ぶ。
+ * タイマは周期モードではなく、割り込みのたびに次のティックの時刻 (TSC) を
+ * 期限として設定し直す。StartLAPICTimerOneShot の期限の方が早ければ、
+ * そちらを先に設定する。
+ */
+void StartLAPICTimerPeriodic();
+
+/** @brief ns ナノ秒後に一度だけ callback を呼ぶ.
+ *
+ * ティックより細かい期限に使う。callback は割り込みの文脈で呼ばれる。
+ * ティックは止めずに、次のティックと早い方の時刻で割り込ませる。
+ * 予約できる期限は 1 つだけで、前の予約があれば置き換える。
+ * InitializeLAPICTimer が成功した後に呼ぶこと。
+ */
+void StartLAPICTimerOneShot(uint64_t ns, void (*callback)());
+
+/** @brief StartLAPICTimerOneShot の予約を取り消す. ティックは止めない */
+void CancelLAPICTimerOneShot();
+
+/** @brief CPU が TSC デッドラインモードに対応していれば true */
+bool HasTSCDeadline();
+
+/** @brief StartLAPICTimerPeriodic からのティック数. 単調に増える */
+uint64_t CurrentTick();
+
+/** @brief StartLAPICTimerPeriodic でティックが進み始めていれば true */
+bool TickRunning();
+
+/** @brief ミリ秒 ms を (切り上げた) ティック数に換算する */
+constexpr uint64_t MillisecondsToTicks(uint64_t ms) {
+    return (ms * kTimerFrequency + 999) / 1000;
+}
+
+/** @brief ティックごとに呼ばれる関数. 割り込みの文脈で呼ばれるので短く済ませること */
+using TimerCallback = void (*)(uint64_t tick);
+
+/** @brief ティックごとに呼ぶ関数を登録する.
+ *
+ * @return 登録できる数を超えた場合は Error::kFull
+ */
+Error AddTimerCallback(TimerCallback callback);
+
+/** @brief Local APIC タイマの割り込みハンドラから呼ぶ */
+void LAPICTimerOnInterrupt();
+
+/** @brief 次のティックまで待つ.
+ *
+ * タスクから割り込みを許可した状態で呼ばれていれば、その間タスクを眠らせて
+ * 他のタスクに CPU を譲る。そうでなければ pause を 1 回実行するだけ。
+ */
+void YieldUntilNextTick();
+
+/** @brief timeout_ms ミリ秒に当たる TSC のサイクル数.
+ *
+ * TSC の周波数が分からなければ 4 GHz とみなす (たいていは長めに待つ)。
+ */
+uint64_t TimeoutCycles(uint64_t timeout_ms);
+
+/** @brief cond() が真になるまで待つ.
+ *
+ * ティックが進んでいれば、確かめるたびに YieldUntilNextTick で次のティックまで
+ * 待つので、優先度の高いタスクから呼んでも他のタスクを止めない。
+ * Local APIC タイマが使えずティックが進まなければ、TSC で時間を測りながら
+ * pause で回る。
+ *
+ * @return timeout_ms ミリ秒待っても真にならなければ Error::kTimeout
+ */
+template <class Cond>
+Error WaitFor(Cond cond, uint64_t timeout_ms) {
+    if (!TickRunning()) {
+        const uint64_t deadline = ReadTSC() + TimeoutCycles(timeout_ms);
+        while (!cond()) {
+            if (ReadTSC() >= deadline) {
+                return MAKE_ERROR(Error::kTimeout);
+            }
+            __asm__("pause");
+        }
+        return MAKE_ERROR(Error::kSuccess);
+    }
+
+    // ティックの途中から数え始めるので、1 ティック余分に待つ
+    const uint64_t deadline =
+        CurrentTick() + MillisecondsToTicks(timeout_ms) + 1;
+    while (!cond()) {
+        if (CurrentTick() >= deadline) {
+            return MAKE_ERROR(Error::kTimeout);
+        }
+        YieldUntilNextTick();
+    }
+    return MAKE_ERROR(Error::kSuccess);
+}
@@ -0,0 +1,167 @@
+#include "timer_wheel.hpp"
+
+#include "interrupt.hpp"
+#include "task.hpp"
+#include "timer.hpp"
+
+namespace {
+    const uint64_t kSlotMask = TimerWheel::kSlotsPerLevel - 1;
+}  // namespace
+
+TimerWheel::TimerWheel(uint64_t now, Task& runner)
+    : runner_{runner}, next_tick_{now + 1} {}
+
+void TimerWheel::Add(Timer& timer, uint64_t expires) {
+    InterruptGuard guard;
+    if (timer.Pending()) {
+        Unlink(timer);
+    } else {
+        ++num_pending_;
+    }
+    timer.expires_ = expires;
+    Insert(timer);
+}
+
+void TimerWheel::AddAfter(Timer& timer, uint64_t ms) {
+    Add(timer, CurrentTick() + MillisecondsToTicks(ms));
+}
+
+void TimerWheel::Cancel(Timer& timer) {
+    InterruptGuard guard;
+    if (!timer.Pending()) {
+        return;
+    }
+    Unlink(timer);
+    --num_pending_;
+}
+
+void TimerWheel::Advance(uint64_t now) {
+    InterruptGuard guard;
+    if (num_pending_ == 0 && next_tick_ <= now) {
+        // スロットはすべて空なので、途中のティックを処理する必要は無い
+        next_tick_ = now + 1;
+    }
+
+    for (; next_tick_ <= now; ++next_tick_) {
+        const int index = next_tick_ & kSlotMask;
+        if (index == 0) {
+            // 下の段が一周したので、上の段から次の区間の分を下ろしてくる.
+            // 上の段もちょうど一周していたら、さらに上からも下ろす
+            for (int level = 1; level < kNumLevels; ++level) {
+                const int slot =
+                    (next_tick_ >> (kLevelBits * level)) & kSlotMask;
+                Cascade(level, slot);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+
+        Timer*& head = slots_[0][index];
+        while (Timer* timer = head) {
+            Unlink(*timer);
+            if (timer->task_) {
+                --num_pending_;
+                task_manager->Wakeup(*timer->task_);
+            } else {
+                AppendExpired(*timer);
+            }
+        }
+    }
+
+    if (expired_) {
+        task_manager->Wakeup(runner_);
+    }
+}
+
+void TimerWheel::RunExpired() {
+    while (1) {
+        Timer* timer;
+        {
+            InterruptGuard guard;
+            timer = expired_;
+            if (timer == nullptr) {
+                return;
+            }
+            Unlink(*timer);
+            --num_pending_;
+        }
+        // 関数の中では割り込みを許可しておく
+        timer->callback_(*timer, timer->arg_);
+    }
+}
+
+bool TimerWheel::HasExpired() {
+    InterruptGuard guard;
+    return expired_ != nullptr;
+}
+
+void TimerWheel::SleepUntil(uint64_t tick) {
+    Timer timer{task_manager->CurrentTask()};
+    Add(timer, tick);
+    {
+        // 確認してから眠るまでの間に期限が来ても取りこぼさないようにする
+        InterruptGuard guard;
+        if (timer.Pending()) {
+            task_manager->Sleep();
+        }
+    }
+    // 他の理由で起こされた場合は、まだ登録されている
+    Cancel(timer);
+}
+
+void TimerWheel::Insert(Timer& timer) {
+    // 期限を過ぎたタイマは、次に処理するティックで期限切れにする
+    uint64_t expires =
+        timer.expires_ < next_tick_ ? next_tick_ : timer.expires_;
+    // 遠すぎる期限は最上段の届く範囲に置き、下ろすときに置き直す
+    if (expires - next_tick_ > kMaxDelta) {
+        expires = next_tick_ + kMaxDelta;
+    }
+
+    const uint64_t delta = expires - next_tick_;
+    int level = 0;
+    while (level < kNumLevels - 1 &&
+           delta >= uint64_t{1} << (kLevelBits * (level + 1))) {
+        ++level;
+    }
+    const int slot = (expires >> (kLevelBits * level)) & kSlotMask;
+    Link(slots_[level][slot], timer);
+}
+
+void TimerWheel::Cascade(int level, int slot) {
+    Timer*& head = slots_[level][slot];
+    while (Timer* timer = head) {
+        Unlink(*timer);
+        Insert(*timer);
+    }
+}
+
+void TimerWheel::Link(Timer*& head, Timer& timer) {
+    timer.next_ = head;
+    if (head) {
+        head->pprev_ = &timer.next_;
+    }
+    head = &timer;
+    timer.pprev_ = &head;
+}
+
+void TimerWheel::AppendExpired(Timer& timer) {
+    timer.next_ = nullptr;
+    timer.pprev_ = expired_tail_;
+    *expired_tail_ = &timer;
+    expired_tail_ = &timer.next_;
+}
+
+void TimerWheel::Unlink(Timer& timer) {
+    if (expired_tail_ == &timer.next_) {
+        // 期限切れのリストの末尾を外すので、末尾を 1 つ前に戻す
+        expired_tail_ = timer.pprev_;
+    }
+    *timer.pprev_ = timer.next_;
+    if (timer.next_) {
+        timer.next_->pprev_ = timer.pprev_;
+    }
+    timer.next_ = nullptr;
+    timer.pprev_ = nullptr;
+}
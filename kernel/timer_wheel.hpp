@@ -0,0 +1,142 @@
+/**
+ * @file timer_wheel.hpp
+ *
+ * 多数のタイムアウトを管理する階層タイマホイールを提供する。
+ */
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+class Task;
+
+/** @brief 期限が来たら関数を 1 回呼んでもらうためのタイマ.
+ *
+ * 使う側が確保して TimerWheel に登録する (ホイールはメモリを確保しない)。
+ * 登録中 (Pending() が true の間) は破棄したり移動したりしないこと。
+ */
+class Timer {
+   public:
+    /** @brief 期限が来たときにメインのタスクで呼ばれる関数.
+     *
+     * 呼ばれる時点でタイマは登録から外れているので、
+     * 中で TimerWheel::Add を呼べば同じタイマを登録し直せる。
+     */
+    using Callback = void (*)(Timer& timer, void* arg);
+
+    Timer(Callback callback, void* arg) : callback_{callback}, arg_{arg} {}
+    /** @brief 期限が来たら、関数を呼ぶ代わりに task を起こすタイマ.
+     *
+     * 起こすだけなので、メインのタスクを待たずにタイマ割り込みの中で起こす。
+     */
+    explicit Timer(Task& task) : task_{&task} {}
+    Timer(const Timer&) = delete;
+    Timer& operator=(const Timer&) = delete;
+
+    /** @brief ホイールに登録されていて、まだ関数が呼ばれていなければ true */
+    bool Pending() const { return pprev_ != nullptr; }
+    /** @brief 期限 (CurrentTick() と同じ単位のティック) */
+    uint64_t Expires() const { return expires_; }
+
+   private:
+    friend class TimerWheel;
+
+    Callback callback_{nullptr};
+    void* arg_{nullptr};
+    Task* task_{nullptr};
+    uint64_t expires_{0};
+    // 片方向に辿るリスト. pprev_ は自分を指しているポインタの場所で、
+    // これがあれば先頭か途中かを区別せずに O(1) で外せる
+    Timer* next_{nullptr};
+    Timer** pprev_{nullptr};
+};
+
+/** @brief 1 段 64 スロットを 4 段重ねたタイマホイール.
+ *
+ * 0 段目のスロットは 1 ティック、k 段目のスロットは 64^k ティックを受け持つ。
+ * 登録と取り消しは段とスロットを計算してリストをつなぎ替えるだけなので O(1)。
+ * 0 段目が一周するたびに、上の段の 1 スロット分を下の段へ振り分け直す。
+ *
+ * ホイールはタイマ割り込みの中の Advance で進める。期限の来たタイマは
+ * まとめて期限切れのリストへ移し、関数を呼ぶタスク (メインのタスク) を起こす。
+ * そのタスクが RunExpired を呼んだときに関数を呼ぶ。
+ * 割り込みハンドラとタスクの両方から触るので、操作の間は割り込みを禁止する。
+ */
+class TimerWheel {
+   public:
+    static const int kLevelBits = 6;
+    static const int kSlotsPerLevel = 1 << kLevelBits;
+    static const int kNumLevels = 4;
+    /** @brief 一度にホイールへ置ける最も遠い期限 (ティック). 約 46 時間.
+     *
+     * これより遠い期限のタイマも登録できる。最上段を何周かしてから発火する。
+     */
+    static const uint64_t kMaxDelta =
+        (uint64_t{1} << (kLevelBits * kNumLevels)) - 1;
+
+    /** @brief now ティックまでは処理済みとして初期化する.
+     *
+     * @param runner  期限切れのタイマの関数を呼ぶ (RunExpired を呼ぶ) タスク
+     */
+    TimerWheel(uint64_t now, Task& runner);
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /** @brief ティック expires に期限が来るように timer を登録する.
+     *
+     * 登録中のタイマなら期限を変更する。
+     * 既に過ぎた期限を指定すると、次の Advance で期限切れになる。
+     */
+    void Add(Timer& timer, uint64_t expires);
+
+    /** @brief ms ミリ秒後に期限が来るように timer を登録する */
+    void AddAfter(Timer& timer, uint64_t ms);
+
+    /** @brief timer の登録を取り消す. 登録されていなければ何もしない */
+    void Cancel(Timer& timer);
+
+    /** @brief ティック now までの期限が来たタイマを期限切れにする.
+     *
+     * タイマ割り込みのハンドラからティックごとに呼ぶ。
+     */
+    void Advance(uint64_t now);
+
+    /** @brief 期限切れのタイマの関数を呼ぶ. runner のタスクから呼ぶ */
+    void RunExpired();
+
+    /** @brief 関数を呼ぶのを待っている期限切れのタイマがあれば true */
+    bool HasExpired();
+
+    /** @brief 今のタスクを、ティック tick になるまで眠らせる.
+     *
+     * 他の理由で Wakeup されたときは、その時点で戻る。
+     * 割り込みを許可した状態で、タスクから呼ぶこと。
+     */
+    void SleepUntil(uint64_t tick);
+
+   private:
+    /** @brief 期限 timer.expires_ に応じた段とスロットに timer をつなぐ */
+    void Insert(Timer& timer);
+    /** @brief level 段目のスロット slot のタイマを、下の段へ振り分け直す */
+    void Cascade(int level, int slot);
+
+    static void Link(Timer*& head, Timer& timer);
+    /** @brief 期限切れのリストの末尾に timer をつなぐ */
+    void AppendExpired(Timer& timer);
+    /** @brief timer をつながっているリストから外す */
+    void Unlink(Timer& timer);
+
+    Task& runner_;
+    // 次に処理するティック. これより前の期限は処理済み
+    uint64_t next_tick_;
+    // 登録中のタイマの数 (期限切れのリストにあるものも含む)
+    uint64_t num_pending_{0};
+    std::array<std::array<Timer*, kSlotsPerLevel>, kNumLevels> slots_{};
+    // 期限切れのタイマ. 期限の早いものから順に並べ、先頭から関数を呼ぶ
+    Timer* expired_{nullptr};
+    // 期限切れのリストの最後の next_ (空なら expired_) の場所
+    Timer** expired_tail_{&expired_};
+};
+
+extern TimerWheel* timer_wheel;
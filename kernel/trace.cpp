@@ -0,0 +1,21 @@
+#include "trace.hpp"
+
+#include <cstring>
+
+TraceBuffer trace_buffer;
+bool trace_enabled = false;
+
+void InitializeTrace() {
+    memcpy(trace_buffer.magic, "KTRACE1", sizeof(trace_buffer.magic));
+    trace_buffer.num_cpus = kMaxTraceCPUs;
+    trace_buffer.records_per_cpu = kTraceRecords;
+    trace_buffer.tsc_hz = 0;
+    for (auto& ring : trace_buffer.rings) {
+        ring.next.store(0, std::memory_order_relaxed);
+    }
+    trace_enabled = true;
+}
+
+void SetTraceTSCFrequency(uint64_t hz) { trace_buffer.tsc_hz = hz; }
+
+void SetTraceEnabled(bool enabled) { trace_enabled = enabled; }
@@ -0,0 +1,126 @@
+/**
+ * @file trace.hpp
+ *
+ * ホットパス向けのバイナリトレースを提供する。
+ *
+ * Log と違って書式化をせず、TSC の値とイベント番号、整数の引数 2 つだけを
+ * 固定長のレコードとして CPU ごとのリングバッファに書き込む。
+ * バッファは古いものから上書きされ (フライトレコーダ)、
+ * 読み出しはホスト側で tools/tracedump.py を使って行う。
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "asmfunc.h"
+
+/** @brief トレースのイベント番号.
+ *
+ * 名前が Begin, End で終わるものは対になって区間を表す。
+ * 行末のコメントは引数の名前で、tools/tracedump.py がそのまま読み取る。
+ * 番号は変えずに末尾へ追加すること。
+ */
+enum TraceEvent : uint16_t {
+    kTraceNone,
+    kTraceProcessEventBegin,  // trb_type
+    kTraceProcessEventEnd,    // error
+    kTraceRingPush,           // trb_type, trb
+    kTraceEventRingPop,       // dequeue
+    kTraceHIDDataBegin,       // len
+    kTraceHIDDataEnd,
+    kTraceFillRect,           // width, height
+    kTraceCopyRect,           // width, height
+    kTraceLayerDrawBegin,     // num_dirty_rects
+    kTraceLayerDrawEnd,
+    kTraceTaskSwitch,         // from, to
+};
+
+/** @brief トレースの 1 レコード. 32 バイト */
+struct TraceRecord {
+    uint64_t tsc;
+    uint16_t event;
+    uint16_t cpu;
+    uint32_t reserved;
+    uint64_t args[2];
+};
+static_assert(sizeof(TraceRecord) == 32);
+
+/** @brief トレースを取る CPU の最大数 */
+const int kMaxTraceCPUs = 4;
+/** @brief CPU 1 つあたりのレコード数. 2 のべき乗 */
+const size_t kTraceRecords = 2048;
+
+/** @brief トレースバッファ全体のメモリ上の形式.
+ *
+ * ホストはメモリダンプの中から magic を探して読み出すので、
+ * 形式を変えたら magic の版数と tools/tracedump.py も合わせて変えること。
+ */
+struct TraceBuffer {
+    char magic[8];  // "KTRACE1"
+    uint32_t num_cpus;
+    uint32_t records_per_cpu;
+    uint64_t tsc_hz;  // 不明なら 0
+    uint64_t reserved;
+
+    struct Ring {
+        /** @brief 次に書くレコードの通し番号. kTraceRecords で割った余りを使う */
+        std::atomic<uint64_t> next;
+        uint64_t reserved[3];
+        TraceRecord records[kTraceRecords];
+    } rings[kMaxTraceCPUs];
+};
+
+/** @brief トレースを組み込むかどうか. make TRACE=0 で取り除く */
+#ifndef TRACE_ENABLED
+#define TRACE_ENABLED 1
+#endif
+
+/** @brief Trace から参照するためだけに公開する */
+extern TraceBuffer trace_buffer;
+extern bool trace_enabled;
+
+/** @brief トレースバッファの見出しを書き、記録を始める.
+ *
+ * これより前の Trace の呼び出しは何も記録しない。
+ */
+void InitializeTrace();
+
+/** @brief トレースバッファに TSC の周波数を書いておく. ホストで時刻に換算するのに使う */
+void SetTraceTSCFrequency(uint64_t hz);
+
+/** @brief 記録を一時的に止める, または再開する */
+void SetTraceEnabled(bool enabled);
+
+/** @brief 現在の CPU の番号. SMP に対応するまでは常に 0 */
+inline int TraceCPU() { return 0; }
+
+/** @brief イベント event を現在の CPU のリングに記録する.
+ *
+ * ロックを取らないので割り込みハンドラからも呼べる。
+ * 同じ CPU 上で割り込まれても、通し番号を先に確保するのでレコードは混ざらない。
+ */
+inline void Trace(TraceEvent event, uint64_t arg0 = 0, uint64_t arg1 = 0) {
+    if (!trace_enabled) {
+        return;
+    }
+    const int cpu = TraceCPU();
+    auto& ring = trace_buffer.rings[cpu];
+    const uint64_t n = ring.next.fetch_add(1, std::memory_order_relaxed);
+    TraceRecord& r = ring.records[n % kTraceRecords];
+    r.tsc = ReadTSC();
+    r.cpu = cpu;
+    r.args[0] = arg0;
+    r.args[1] = arg1;
+    r.event = event;
+}
+
+/** @brief トレースポイント. TRACE_ENABLED が 0 なら何も生成しない */
+#define TRACE(...)                          \
+    do {                                    \
+        if constexpr (TRACE_ENABLED) {      \
+            Trace(__VA_ARGS__);             \
+        }                                   \
+    } while (0)
@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "logger.hpp"
+#include "trace.hpp"
 #include "usb/device.hpp"
 
 namespace usb {
@@ -44,7 +45,7 @@ namespace usb {
     Error HIDBaseDriver::OnControlCompleted(EndpointID ep_id,
                                             SetupData setup_data,
                                             const void* buf, int len) {
-        Log(kDebug,
+        LOG(kLogHID, kDebug,
             "HIDBaseDriver::OnControlCompleted: dev %08x, phase = %d, len = "
             "%d\n",
             this, initialize_phase_, len);
@@ -60,7 +61,9 @@ namespace usb {
     Error HIDBaseDriver::OnInterruptCompleted(EndpointID ep_id, const void* buf,
                                               int len) {
         if (ep_id.IsIn()) {
+            TRACE(kTraceHIDDataBegin, len);
             OnDataReceived();
+            TRACE(kTraceHIDDataEnd);
             std::copy_n(buf_.begin(), len, previous_buf_.begin());
             return ParentDevice()->InterruptIn(ep_interrupt_in_, buf_.data(),
                                                in_packet_size_);
@@ -110,7 +110,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
+    LOG(kLogXHCI, kDebug, "Device::ControlIn: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -157,7 +157,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
+    LOG(kLogXHCI, kDebug, "Device::ControlOut: ep addr %d, buf 0x%08x, len %d\n",
         ep_id.Address(), buf, len);
     if (ep_id.Number() < 0 || 15 < ep_id.Number()) {
       return MAKE_ERROR(Error::kInvalidEndpointNumber);
@@ -227,7 +227,7 @@ namespace usb::xhci {
       return err;
     }
 
-    Log(kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
+    LOG(kLogXHCI, kDebug, "Device::InterrutpOut: ep addr %d, buf %08lx, len %d, dev %08lx\n",
         ep_id.Address(), buf, len, this);
     return MAKE_ERROR(Error::kNotImplemented);
   }
@@ -237,10 +237,10 @@ namespace usb::xhci {
 
     if (trb.bits.completion_code != 1 /* Success */ &&
         trb.bits.completion_code != 13 /* Short Packet */) {
-      Log(kDebug, trb);
+      LOG(kLogXHCI, kDebug, trb);
       return MAKE_ERROR(Error::kTransferFailed);
     }
-    Log(kDebug, trb);
+    LOG(kLogXHCI, kDebug, trb);
 
     TRB* issuer_trb = trb.Pointer();
     if (auto normal_trb = TRBDynamicCast<NormalTRB>(issuer_trb)) {
@@ -252,10 +252,10 @@ namespace usb::xhci {
 
     auto opt_setup_stage_trb = setup_stage_map_.Get(issuer_trb);
     if (!opt_setup_stage_trb) {
-      Log(kDebug, "No Corresponding Setup Stage for issuer %s\n",
+      LOG(kLogXHCI, kDebug, "No Corresponding Setup Stage for issuer %s\n",
           kTRBTypeToName[issuer_trb->bits.trb_type]);
       if (auto data_trb = TRBDynamicCast<DataStageTRB>(issuer_trb)) {
-        Log(kDebug, *data_trb);
+        LOG(kLogXHCI, kDebug, *data_trb);
       }
       return MAKE_ERROR(Error::kNoCorrespondingSetupStage);
     }
@@ -1,5 +1,6 @@
 #include "usb/xhci/port.hpp"
 
+#include "timer.hpp"
 #include "usb/xhci/xhci.hpp"
 #include "usb/xhci/registers.hpp"
 
@@ -33,8 +34,10 @@ namespace usb::xhci {
     portsc.data[0] &= 0x0e00c3e0u;
     portsc.data[0] |= 0x00020010u; // Write 1 to PR and CSC
     port_reg_set_.PORTSC.Write(portsc);
-    while (port_reg_set_.PORTSC.Read().bits.port_reset);
-    return MAKE_ERROR(Error::kSuccess);
+    // USB 2.0 のリセットは 10 から 20 ミリ秒で終わるので、十分長めに待つ
+    return WaitFor([this] {
+      return !port_reg_set_.PORTSC.Read().bits.port_reset;
+    }, 100);
   }
 
   Device* Port::Initialize() {
@@ -1,5 +1,6 @@
 #include "usb/xhci/ring.hpp"
 
+#include "trace.hpp"
 #include "usb/memory.hpp"
 
 namespace usb::xhci {
@@ -39,6 +40,8 @@ namespace usb::xhci {
   TRB* Ring::Push(const std::array<uint32_t, 4>& data) {
     auto trb_ptr = &buf_[write_index_];
     CopyToLast(data);
+    TRACE(kTraceRingPush, trb_ptr->bits.trb_type,
+          reinterpret_cast<uintptr_t>(trb_ptr));
 
     ++write_index_;
     if (write_index_ == buf_size_ - 1) {
@@ -111,5 +114,6 @@ namespace usb::xhci {
     }
 
     WriteDequeuePointer(p);
+    TRACE(kTraceEventRingPop, reinterpret_cast<uintptr_t>(p));
   }
 }
@@ -1,6 +1,8 @@
 #include "usb/xhci/xhci.hpp"
 
 #include "logger.hpp"
+#include "timer.hpp"
+#include "trace.hpp"
 #include "usb/setupdata.hpp"
 #include "usb/device.hpp"
 #include "usb/descriptor.hpp"
@@ -85,9 +87,25 @@ namespace {
     ctx.bits.error_count = 3;
   }
 
+  Error ResetPort(Controller& xhc, Port& port);
+
+  /** addressing_port を空け，kWaitingAddressed で待っているポートがあれば
+   * そのうち 1 つのリセットを始める．
+   */
+  Error ResetNextWaitingPort(Controller& xhc) {
+    addressing_port = 0;
+    for (int i = 0; i < port_config_phase.size(); ++i) {
+      if (port_config_phase[i] == ConfigPhase::kWaitingAddressed) {
+        auto port = xhc.PortAt(i);
+        return ResetPort(xhc, port);
+      }
+    }
+    return MAKE_ERROR(Error::kSuccess);
+  }
+
   Error ResetPort(Controller& xhc, Port& port) {
     const bool is_connected = port.IsConnected();
-    Log(kDebug, "ResetPort: port.IsConnected() = %s\n",
+    LOG(kLogXHCI, kDebug, "ResetPort: port.IsConnected() = %s\n",
         is_connected ? "true" : "false");
 
     if (!is_connected) {
@@ -104,7 +122,14 @@ namespace {
       }
       addressing_port = port.Number();
       port_config_phase[port.Number()] = ConfigPhase::kResettingPort;
-      port.Reset();
+      if (auto err = port.Reset()) {
+        // 待っている他のポートがアドレスの割り当てを始められるようにする
+        port_config_phase[port.Number()] = ConfigPhase::kNotConnected;
+        if (auto next_err = ResetNextWaitingPort(xhc)) {
+          LOG(kLogXHCI, kWarn, "ResetNextWaitingPort: %s\n", next_err.Name());
+        }
+        return err;
+      }
     }
     return MAKE_ERROR(Error::kSuccess);
   }
@@ -112,7 +137,7 @@ namespace {
   Error EnableSlot(Controller& xhc, Port& port) {
     const bool is_enabled = port.IsEnabled();
     const bool reset_completed = port.IsPortResetChanged();
-    Log(kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
+    LOG(kLogXHCI, kDebug, "EnableSlot: port.IsEnabled() = %s, port.IsPortResetChanged() = %s\n",
         is_enabled ? "true" : "false",
         reset_completed ? "true" : "false");
 
@@ -129,7 +154,7 @@ namespace {
   }
 
   Error AddressDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    LOG(kLogXHCI, kDebug, "AddressDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     xhc.DeviceManager()->AllocDevice(slot_id, xhc.DoorbellRegisterAt(slot_id));
 
@@ -164,7 +189,7 @@ namespace {
   }
 
   Error InitializeDevice(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    LOG(kLogXHCI, kDebug, "InitializeDevice: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -178,7 +203,7 @@ namespace {
   }
 
   Error CompleteConfiguration(Controller& xhc, uint8_t port_id, uint8_t slot_id) {
-    Log(kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
+    LOG(kLogXHCI, kDebug, "CompleteConfiguration: port_id = %d, slot_id = %d\n", port_id, slot_id);
 
     auto dev = xhc.DeviceManager()->FindBySlot(slot_id);
     if (dev == nullptr) {
@@ -192,7 +217,7 @@ namespace {
   }
 
   Error OnEvent(Controller& xhc, PortStatusChangeEventTRB& trb) {
-    Log(kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
+    LOG(kLogXHCI, kDebug, "PortStatusChangeEvent: port_id = %d\n", trb.bits.port_id);
     auto port_id = trb.bits.port_id;
     auto port = xhc.PortAt(port_id);
 
@@ -227,7 +252,7 @@ namespace {
   Error OnEvent(Controller& xhc, CommandCompletionEventTRB& trb) {
     const auto issuer_type = trb.Pointer()->bits.trb_type;
     const auto slot_id = trb.bits.slot_id;
-    Log(kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
+    LOG(kLogXHCI, kDebug, "CommandCompletionEvent: slot_id = %d, issuer = %s\n",
         trb.bits.slot_id, kTRBTypeToName[issuer_type]);
 
     if (issuer_type == EnableSlotCommandTRB::Type) {
@@ -251,15 +276,8 @@ namespace {
         return MAKE_ERROR(Error::kInvalidPhase);
       }
 
-      addressing_port = 0;
-      for (int i = 0; i < port_config_phase.size(); ++i) {
-        if (port_config_phase[i] == ConfigPhase::kWaitingAddressed) {
-          auto port = xhc.PortAt(i);
-          if (auto err = ResetPort(xhc, port); err) {
-            return err;
-          }
-          break;
-        }
+      if (auto err = ResetNextWaitingPort(xhc); err) {
+        return err;
       }
 
       return InitializeDevice(xhc, port_id, slot_id);
@@ -299,14 +317,14 @@ namespace {
     }
 
     r.bits.hc_os_owned_semaphore = 1;
-    Log(kDebug, "waiting until OS owns xHC...\n");
+    LOG(kLogXHCI, kDebug, "waiting until OS owns xHC...\n");
     reg.Write(r);
 
     do {
       r = reg.Read();
     } while (r.bits.hc_bios_owned_semaphore ||
              !r.bits.hc_os_owned_semaphore);
-    Log(kDebug, "OS has owned xHC\n");
+    LOG(kLogXHCI, kDebug, "OS has owned xHC\n");
   }
 }
 
@@ -347,7 +365,7 @@ namespace usb::xhci {
     while (op_->USBCMD.Read().bits.host_controller_reset);
     while (op_->USBSTS.Read().bits.controller_not_ready);
 
-    Log(kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
+    LOG(kLogXHCI, kDebug, "MaxSlots: %u\n", cap_->HCSPARAMS1.Read().bits.max_device_slots);
     // Set "Max Slots Enabled" field in CONFIG.
     auto config = op_->CONFIG.Read();
     config.bits.max_device_slots_enabled = kDeviceSize;
@@ -361,11 +379,11 @@ namespace usb::xhci {
       auto scratchpad_buf_arr = AllocArray<void*>(max_scratchpad_buffers, 64, 4096);
       for (int i = 0; i < max_scratchpad_buffers; ++i) {
         scratchpad_buf_arr[i] = AllocMem(4096, 4096, 4096);
-        Log(kDebug, "scratchpad buffer array %d = %p\n",
+        LOG(kLogXHCI, kDebug, "scratchpad buffer array %d = %p\n",
             i, scratchpad_buf_arr[i]);
       }
       devmgr_.DeviceContexts()[0] = reinterpret_cast<DeviceContext*>(scratchpad_buf_arr);
-      Log(kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
+      LOG(kLogXHCI, kInfo, "wrote scratchpad buffer array %p to dev ctx array 0\n",
           scratchpad_buf_arr);
     }
 
@@ -404,9 +422,10 @@ namespace usb::xhci {
     op_->USBCMD.Write(usbcmd);
     op_->USBCMD.Read();
 
-    while (op_->USBSTS.Read().bits.host_controller_halted);
-
-    return MAKE_ERROR(Error::kSuccess);
+    // HCHalted は Run/Stop を立ててから 16 ミリ秒以内に下りる
+    return WaitFor([this] {
+      return !op_->USBSTS.Read().bits.host_controller_halted;
+    }, 100);
   }
 
   DoorbellRegister* Controller::DoorbellRegisterAt(uint8_t index) {
@@ -492,6 +511,7 @@ namespace usb::xhci {
 
     Error err = MAKE_ERROR(Error::kNotImplemented);
     auto event_trb = xhc.PrimaryEventRing()->Front();
+    TRACE(kTraceProcessEventBegin, event_trb->bits.trb_type);
     if (auto trb = TRBDynamicCast<TransferEventTRB>(event_trb)) {
       err = OnEvent(xhc, *trb);
     } else if (auto trb = TRBDynamicCast<PortStatusChangeEventTRB>(event_trb)) {
@@ -500,6 +520,7 @@ namespace usb::xhci {
       err = OnEvent(xhc, *trb);
     }
     xhc.PrimaryEventRing()->Pop();
+    TRACE(kTraceProcessEventEnd, err.Cause());
 
     return err;
   }
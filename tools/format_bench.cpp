@@ -0,0 +1,81 @@
+// kernel/format.cpp の書式化をホストの snprintf と比べる.
+//
+// 同じ書式と引数で結果が一致するかを確かめてから、ログでよく使う形の
+// 書式化を繰り返して 1 回あたりの時間を測る。リポジトリの根元で
+//
+//   g++ -O2 -std=c++17 -Ikernel -o format_bench
+//       tools/format_bench.cpp kernel/format.cpp
+//   ./format_bench
+//
+// のようにビルドして実行する (g++ の 2 行は 1 行につなげる)。
+// カーネルと同じ newlib の vsnprintf と比べたい場合は、
+// newlib をリンクしたホスト用のツールチェインでビルドする。
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "format.hpp"
+
+namespace {
+    int failures = 0;
+
+    // FormatString と snprintf の結果 (文字列と戻り値) を比べる
+    template <class... Args>
+    void Check(const char* format, Args... args) {
+        char ours[256], libc[256];
+        const int n = FormatString(ours, sizeof(ours), format, args...);
+        snprintf(libc, sizeof(libc), format, args...);
+        if (strcmp(ours, libc) != 0 || n != static_cast<int>(strlen(libc))) {
+            printf("MISMATCH \"%s\": [%s] vs [%s]\n", format, ours, libc);
+            ++failures;
+        }
+    }
+
+    template <class F>
+    double NanosecondsPerCall(int iterations, F f) {
+        const auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i) {
+            f(i);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(end - begin).count() /
+               iterations;
+    }
+}  // namespace
+
+int main(int argc, char** argv) {
+    Check("%d %d %d", 0, -5, 2147483647);
+    Check("%ld %lu %lld", -1234567890123L, 18446744073709551615UL,
+          -9223372036854775807LL - 1);
+    Check("%02x %04x %08x %08lx %x %X", 5, 0xabc, 0xdeadbeef,
+          0x123456789aUL, 0, 0xff);
+    Check("%p", reinterpret_cast<void*>(0x1234));
+    Check("%s|%10s|%-10s|%.3s", "hi", "ab", "cd", "abcdef");
+    Check("%3d|%-3d|%03d|%5.3d|%c|%%|%zu", 7, 7, -7, 42, 'x',
+          static_cast<size_t>(99));
+    Check("%*d|%-*d", 5, 1, 4, 2);
+    if (failures) {
+        printf("%d mismatches\n", failures);
+        return 1;
+    }
+
+    // PCI のスキャン結果のログに近い書式
+    const char* kFormat = "%d.%d.%d: vend %04x, class %08x, head %02x %s\n";
+    const int kIterations = 2'000'000;
+    char buf[1024];
+    volatile int sink = 0;
+
+    const double ours = NanosecondsPerCall(kIterations, [&](int i) {
+        sink += FormatString(buf, sizeof(buf), kFormat, i, i & 31, i & 7,
+                             0x8086, i, i & 0xff, "xhc");
+    });
+    const double libc = NanosecondsPerCall(kIterations, [&](int i) {
+        sink += snprintf(buf, sizeof(buf), kFormat, i, i & 31, i & 7, 0x8086,
+                         i, i & 0xff, "xhc");
+    });
+    printf("FormatString: %.1f ns/call, snprintf: %.1f ns/call\n", ours,
+           libc);
+    return 0;
+}
@@ -4,10 +4,29 @@ import argparse
 import collections
 import functools
 import re
+import struct
 import sys
 
 
 BITMAP_PATTERN = re.compile(r'([.*@]+)')
+CODEPOINT_PATTERN = re.compile(r'(?:U\+|0x)([0-9a-fA-F]+)')
+
+# 全角フォントのアトラスの形式 (数値はすべてリトルエンディアン)
+#
+#   char     magic[4]                  "ZKA1"
+#   uint16   num_pages, num_glyphs
+#   uint16   page_of[256]              コードポイントの上位 8 ビット -> ページ番号
+#   uint16   pages[num_pages][256]     コードポイントの下位 8 ビット -> グリフ番号
+#   uint32   offsets[num_glyphs]       グリフのデータの位置 (glyph_data の先頭から)
+#   uint8    glyph_data[]
+#
+# 該当するものが無い場合、ページ番号やグリフ番号は 0xffff になる。
+# 各グリフは上下の空白行を除いて圧縮し、
+# 先頭行 (1 バイト)、行数 (1 バイト)、各行 16 ビット (ビッグエンディアン) で表す。
+ATLAS_MAGIC = b'ZKA1'
+ATLAS_NONE = 0xffff
+ZENKAKU_WIDTH = 16
+ZENKAKU_HEIGHT = 16
 
 
 def compile(src: str) -> bytes:
@@ -26,15 +45,186 @@ def compile(src: str) -> bytes:
     return b''.join(result)
 
 
+def compile_header(src: str, name: str) -> str:
+    """半角フォントを constexpr な配列として定義する C++ ヘッダを作る"""
+    data = compile(src)
+    glyphs = [data[i:i + 16] for i in range(0, len(data), 16)]
+    glyphs += [bytes(16)] * (256 - len(glyphs))
+
+    lines = [
+        '// tools/makefont.py が %s から生成したファイル. 編集しないこと' % name,
+        '#pragma once',
+        '',
+        '#include <cstdint>',
+        '',
+        'namespace font_data {',
+        '    // 文字コードごとの 8x16 のビットマップ. 最上位ビットが左端のピクセル',
+        '    inline constexpr uint8_t kHankaku[256][16] = {',
+    ]
+    for code, glyph in enumerate(glyphs[:256]):
+        lines.append('        {%s},  // 0x%02x' %
+                     (', '.join('0x%02x' % b for b in glyph), code))
+    lines += [
+        '    };',
+        '',
+        '    // ビットマップの 1 行 (8 ビット) の値ごとに、各ピクセルのマスク.',
+        '    // ビットが 1 なら 0xffffffff、0 なら 0 になる',
+        '    inline constexpr uint32_t kRowMasks[256][8] = {',
+    ]
+    for bits in range(256):
+        masks = ['0xffffffff' if (bits << i) & 0x80 else '0x00000000'
+                 for i in range(8)]
+        lines.append('        {%s},' % ', '.join(masks))
+    lines += [
+        '    };',
+        '}  // namespace font_data',
+        '',
+    ]
+    return '\n'.join(lines)
+
+
+def parse_bitmap_glyphs(src: str) -> dict:
+    """U+XXXX の行に続けて 16 行の .@ のビットマップを並べた形式を読む"""
+    glyphs = {}
+    codepoint = None
+    rows = []
+
+    for line in src.splitlines():
+        m = CODEPOINT_PATTERN.match(line)
+        if m:
+            codepoint = int(m.group(1), 16)
+            rows = []
+            continue
+
+        m = BITMAP_PATTERN.match(line)
+        if not m or codepoint is None:
+            continue
+
+        bits = [(0 if x == '.' else 1) for x in m.group(1)]
+        bits += [0] * (ZENKAKU_WIDTH - len(bits))
+        rows.append(functools.reduce(lambda a, b: 2*a + b,
+                                     bits[:ZENKAKU_WIDTH]))
+        if len(rows) == ZENKAKU_HEIGHT:
+            glyphs[codepoint] = rows
+            codepoint = None
+
+    return glyphs
+
+
+def jis_to_unicode(code: int):
+    try:
+        return ord(bytes([(code >> 8) | 0x80, (code & 0xff) | 0x80])
+                   .decode('euc_jp'))
+    except (UnicodeDecodeError, TypeError):
+        return None
+
+
+def parse_bdf(src: str) -> dict:
+    """16x16 の BDF フォントを読む. 符号化が JIS X 0208 なら Unicode に変換する"""
+    glyphs = {}
+    is_jis = False
+    codepoint = None
+    offset_y = 0
+    rows = None
+
+    for line in src.splitlines():
+        words = line.split()
+        if not words:
+            continue
+
+        if words[0] == 'CHARSET_REGISTRY':
+            is_jis = 'JISX0208' in line.upper()
+        elif words[0] == 'ENCODING':
+            # ENCODING -1 は符号の割り当てられていないグリフなので読み飛ばす
+            code = int(words[1])
+            if not 0 <= code <= 0xffff:
+                codepoint = None
+            elif is_jis:
+                codepoint = jis_to_unicode(code)
+            else:
+                codepoint = code
+        elif words[0] == 'BBX':
+            # グリフの下端がベースラインからどれだけ離れているか
+            height, y = int(words[2]), int(words[4])
+            offset_y = ZENKAKU_HEIGHT - 2 - (height + y)
+        elif words[0] == 'BITMAP':
+            rows = []
+        elif words[0] == 'ENDCHAR':
+            if codepoint is not None and rows is not None:
+                bitmap = [0] * ZENKAKU_HEIGHT
+                for i, row in enumerate(rows):
+                    if 0 <= offset_y + i < ZENKAKU_HEIGHT:
+                        bitmap[offset_y + i] = row
+                glyphs[codepoint] = bitmap
+            codepoint = None
+            rows = None
+        elif rows is not None:
+            bits = int(words[0], 16)
+            width = 4 * len(words[0])
+            rows.append((bits << ZENKAKU_WIDTH >> width) & 0xffff)
+
+    return glyphs
+
+
+def compile_atlas(glyphs: dict) -> bytes:
+    glyphs = {cp: rows for cp, rows in glyphs.items() if 0 <= cp <= 0xffff}
+
+    page_numbers = {}
+    for cp in sorted(glyphs):
+        page_numbers.setdefault(cp >> 8, len(page_numbers))
+
+    page_of = [ATLAS_NONE] * 256
+    for page, number in page_numbers.items():
+        page_of[page] = number
+
+    pages = [[ATLAS_NONE] * 256 for _ in page_numbers]
+    offsets = []
+    data = bytearray()
+    for number, cp in enumerate(sorted(glyphs)):
+        pages[page_numbers[cp >> 8]][cp & 0xff] = number
+        offsets.append(len(data))
+
+        rows = glyphs[cp]
+        used = [i for i, row in enumerate(rows) if row]
+        top = used[0] if used else 0
+        height = used[-1] - top + 1 if used else 0
+        data += bytes([top, height])
+        for row in rows[top:top + height]:
+            data += row.to_bytes(2, byteorder='big')
+
+    result = bytearray(ATLAS_MAGIC)
+    result += struct.pack('<HH', len(pages), len(offsets))
+    result += struct.pack('<256H', *page_of)
+    for page in pages:
+        result += struct.pack('<256H', *page)
+    result += struct.pack('<%dI' % len(offsets), *offsets)
+    result += data
+    return bytes(result)
+
+
 def main():
     parser = argparse.ArgumentParser()
     parser.add_argument('font', help='path to a font file')
     parser.add_argument('-o', help='path to an output file', default='font.out')
+    parser.add_argument('--atlas', action='store_true',
+                        help='compile a full-width (16x16) font into an atlas.'
+                        ' the font is either a .bdf file or U+XXXX bitmaps')
+    parser.add_argument('--header', action='store_true',
+                        help='emit a C++ header with constexpr glyph tables'
+                        ' instead of a binary')
     ns = parser.parse_args()
 
-    with open(ns.o, 'wb') as out, open(ns.font) as font:
+    with open(ns.o, 'wb') as out, open(ns.font, errors='replace') as font:
         src = font.read()
-        out.write(compile(src))
+        if ns.header:
+            name = ns.font.split('/')[-1]
+            out.write(compile_header(src, name).encode('utf-8'))
+        elif not ns.atlas:
+            out.write(compile(src))
+        elif ns.font.endswith('.bdf'):
+            out.write(compile_atlas(parse_bdf(src)))
+        else:
+            out.write(compile_atlas(parse_bitmap_glyphs(src)))
 
 
 if __name__ == '__main__':
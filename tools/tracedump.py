@@ -0,0 +1,173 @@
+#!/usr/bin/python3
+
+"""カーネルのトレースバッファを Chrome のトレース形式 (JSON) に変換する.
+
+トレースバッファはカーネル起動時にログへ出る位置から、QEMU のモニタで
+    pmemsave <アドレス> <バイト数> trace.bin
+のように取り出す。メモリ全体のダンプを渡してもよい (magic を探して読む)。
+出力は chrome://tracing や Perfetto でそのまま開ける。
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+
+# kernel/trace.hpp の TraceBuffer と揃えること (数値はすべてリトルエンディアン)
+#
+#   char     magic[8]                  "KTRACE1"
+#   uint32   num_cpus, records_per_cpu
+#   uint64   tsc_hz                    不明なら 0
+#   uint64   reserved
+#   CPU ごとに:
+#     uint64   next                    次に書くレコードの通し番号
+#     uint64   reserved[3]
+#     record   records[records_per_cpu]
+#
+# record は tsc (uint64), event (uint16), cpu (uint16), reserved (uint32),
+# args (uint64 x 2) の 32 バイト。
+TRACE_MAGIC = b'KTRACE1\0'
+HEADER = struct.Struct('<8sIIQQ')
+RING_HEADER = struct.Struct('<Q24x')
+RECORD = struct.Struct('<QHHIQQ')
+# kMaxTraceCPUs と、kTraceRecords として許す最大値
+MAX_CPUS = 4
+MAX_RECORDS_PER_CPU = 1 << 16
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(__file__), '..', 'kernel',
+                              'trace.hpp')
+ENUM_PATTERN = re.compile(r'enum TraceEvent\b[^{]*\{(.*?)\};', re.DOTALL)
+ENUMERATOR_PATTERN = re.compile(r'^\s*kTrace(\w+)\s*,?\s*(?://\s*(.*))?$')
+
+
+def parse_events(src: str) -> list:
+    """trace.hpp の TraceEvent から (名前, 引数名のリスト) を番号順に返す."""
+    m = ENUM_PATTERN.search(src)
+    if not m:
+        raise ValueError('enum TraceEvent not found')
+
+    events = []
+    for line in m.group(1).splitlines():
+        m = ENUMERATOR_PATTERN.match(line)
+        if not m:
+            continue
+        args = [a.strip() for a in (m.group(2) or '').split(',') if a.strip()]
+        events.append((m.group(1), args))
+    return events
+
+
+def find_buffer(dump: bytes) -> int:
+    """ダンプの中でトレースバッファが始まる位置を返す.
+
+    メモリ全体のダンプではカーネルのイメージにある "KTRACE1" の文字列にも
+    一致するので、ヘッダの値がもっともらしく、バッファ全体がダンプに
+    収まるものだけを採る。
+    """
+    offset = dump.find(TRACE_MAGIC)
+    while offset >= 0:
+        if offset % 8 == 0 and offset + HEADER.size <= len(dump):
+            _, num_cpus, records_per_cpu, _, _ = HEADER.unpack_from(dump,
+                                                                    offset)
+            size = HEADER.size + num_cpus * (
+                RING_HEADER.size + RECORD.size * records_per_cpu)
+            if (1 <= num_cpus <= MAX_CPUS and
+                    0 < records_per_cpu <= MAX_RECORDS_PER_CPU and
+                    records_per_cpu & (records_per_cpu - 1) == 0 and
+                    offset + size <= len(dump)):
+                return offset
+        offset = dump.find(TRACE_MAGIC, offset + 1)
+    raise ValueError('trace buffer not found')
+
+
+def read_records(dump: bytes) -> tuple:
+    """ダンプからトレースバッファを探し、(tsc_hz, レコードのリスト) を返す."""
+    offset = find_buffer(dump)
+    _, num_cpus, records_per_cpu, tsc_hz, _ = HEADER.unpack_from(dump, offset)
+    offset += HEADER.size
+
+    records = []
+    for _ in range(num_cpus):
+        (next_index,) = RING_HEADER.unpack_from(dump, offset)
+        offset += RING_HEADER.size
+
+        # 一周していなければ先頭から next_index 個, していれば全部が有効
+        count = min(next_index, records_per_cpu)
+        for i in range(count):
+            rec = RECORD.unpack_from(dump, offset + RECORD.size * i)
+            if rec[1] != 0:
+                records.append(rec)
+        offset += RECORD.size * records_per_cpu
+
+    records.sort(key=lambda rec: rec[0])
+    return tsc_hz, records
+
+
+def to_chrome_trace(events: list, tsc_hz: int, records: list) -> dict:
+    if not records:
+        return {'traceEvents': []}
+
+    base = records[0][0]
+    trace_events = []
+    for tsc, event, cpu, _, arg0, arg1 in records:
+        if event < len(events):
+            name, arg_names = events[event]
+        else:
+            name, arg_names = 'Event{}'.format(event), []
+
+        phase = 'i'
+        if name.endswith('Begin'):
+            name, phase = name[:-len('Begin')], 'B'
+        elif name.endswith('End'):
+            name, phase = name[:-len('End')], 'E'
+
+        entry = {
+            'name': name,
+            'ph': phase,
+            'ts': (tsc - base) * 1e6 / tsc_hz,
+            'pid': 0,
+            'tid': cpu,
+        }
+        if phase == 'i':
+            entry['s'] = 't'
+        args = {n: v for n, v in zip(arg_names, (arg0, arg1))}
+        if args:
+            entry['args'] = args
+        trace_events.append(entry)
+
+    return {'traceEvents': trace_events, 'displayTimeUnit': 'ns'}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument('dump', help='path to a dumped trace buffer')
+    parser.add_argument('-o', help='path to an output file (default: stdout)')
+    parser.add_argument('--header', default=DEFAULT_HEADER,
+                        help='path to trace.hpp to take event names from')
+    parser.add_argument('--tsc-hz', type=float,
+                        help='TSC frequency. overrides the value recorded in'
+                        ' the buffer, which is required if it is 0')
+    ns = parser.parse_args()
+
+    with open(ns.header) as f:
+        events = parse_events(f.read())
+    with open(ns.dump, 'rb') as f:
+        tsc_hz, records = read_records(f.read())
+
+    if ns.tsc_hz:
+        tsc_hz = ns.tsc_hz
+    if not tsc_hz:
+        sys.exit('TSC frequency is unknown; specify --tsc-hz')
+
+    result = to_chrome_trace(events, tsc_hz, records)
+    if ns.o:
+        with open(ns.o, 'w') as out:
+            json.dump(result, out)
+    else:
+        json.dump(result, sys.stdout)
+
+
+if __name__ == '__main__':
+    main()